@@ -25,9 +25,13 @@
 
 #include "pcAdapter.h"
 #include "pcError.h"
+#include "pcPointLocator.h"
 
 #include <cstring>
 #include <cassert>
+#include <string>
+#include <vector>
+#include <algorithm>
 #include <stdlib.h>
 #include <unistd.h>
 
@@ -89,20 +93,97 @@ namespace {
     m->verify();
   }
 
+  const int numVars = 5; // p, u, v, w, t
+
+  /* values and gradients of p, u, v, w, t at the quadrature points of one
+     element: vals[numVars*i+v] and grads[3*(numVars*i+v)+k] = d/dx_k */
+  struct QuadratureBatch {
+    std::vector<apf::Vector3> xi;
+    std::vector<double> wdv;
+    std::vector<double> vals;
+    std::vector<double> grads;
+    void resize(int n) {
+      xi.resize(n);
+      wdv.resize(n);
+      vals.resize(n*numVars);
+      grads.resize(n*numVars*3);
+    }
+  };
+
+  /* evaluate pressure, velocity and temperature at points [first,last)
+     of the batch, all within element me */
+  void evaluateBatch(apf::MeshElement* me, apf::Field* const* flds,
+                     QuadratureBatch& q, int first, int last) {
+    apf::Element* fe0 = apf::createElement(flds[0],me);
+    apf::Element* fe1 = apf::createElement(flds[1],me);
+    apf::Element* fe2 = apf::createElement(flds[2],me);
+    apf::Vector3 v;
+    apf::Vector3 dp;
+    apf::Vector3 dt;
+    apf::Matrix3x3 dv;
+    for (int i = first; i < last; i++) {
+      double* val = &q.vals[i*numVars];
+      double* grad = &q.grads[i*numVars*3];
+      apf::getVector(fe1,q.xi[i],v);
+      apf::getGrad(fe0,q.xi[i],dp);
+      apf::getVectorGrad(fe1,q.xi[i],dv);
+      apf::getGrad(fe2,q.xi[i],dt);
+      val[0] = apf::getScalar(fe0,q.xi[i]);
+      val[4] = apf::getScalar(fe2,q.xi[i]);
+      for (int k = 0; k < 3; k++) {
+        val[1+k] = v[k];
+        grad[k] = dp[k];
+        grad[12+k] = dt[k];
+        for (int c = 0; c < 3; c++) // dv[j][c] is d(v_c)/dx_j
+          grad[3*(1+c)+k] = dv[k][c];
+      }
+    }
+    apf::destroyElement(fe0);
+    apf::destroyElement(fe1);
+    apf::destroyElement(fe2);
+  }
+
+  /* efficiency of one element: VMS error estimate over true error */
+  struct EfficiencyFields {
+    apf::Field* p;
+    apf::Field* v;
+    apf::Field* t;
+  };
+
+  EfficiencyFields createEfficiencyFields(apf::Mesh* m, const char* suffix) {
+    int nsd = m->getDimension();
+    std::string p = std::string("pressure_efficiency") + suffix;
+    std::string v = std::string("velocity_efficiency") + suffix;
+    std::string t = std::string("temperature_efficiency") + suffix;
+    EfficiencyFields f;
+    f.p = apf::createField(m,p.c_str(),apf::SCALAR,apf::getConstant(nsd));
+    f.v = apf::createField(m,v.c_str(),apf::VECTOR,apf::getConstant(nsd));
+    f.t = apf::createField(m,t.c_str(),apf::SCALAR,apf::getConstant(nsd));
+    return f;
+  }
+
+  void setEfficiency(EfficiencyFields& f, apf::MeshEntity* e,
+                     const double* vms, const double* err) {
+    apf::setScalar(f.p,e,0,vms[0]/sqrt(err[0]));
+    apf::setVector(f.v,e,0,apf::Vector3(vms[1]/sqrt(err[1]),
+                                        vms[2]/sqrt(err[2]),
+                                        vms[3]/sqrt(err[3])));
+    apf::setScalar(f.t,e,0,vms[4]/sqrt(err[4]));
+  }
+
   void calculateEfficiency(ph::Input src_ctrl, apf::Mesh2*& src_m,
-                           ph::Input dst_ctrl, apf::Mesh2*& dst_m) {
+                           ph::Input dst_ctrl, apf::Mesh2*& dst_m,
+                           const char* locatorCache, int threads) {
     pProgress progress = Progress_new();
     Progress_setDefaultCallback(progress);
 
     // load fields from the source/reference mesh
-    int num_flds = 3;
     chef::readAndAttachFields(src_ctrl,src_m);
     PCU_ALWAYS_ASSERT(src_m->findField("solution"));
     removeFieldsExceptSol(src_m);
-    pField* src_sol_fld = new pField[num_flds];
-    src_sol_fld[0] = apf::getSIMField(chef::extractField(src_m,"solution","pressure",1,apf::SCALAR,1));
-    src_sol_fld[1] = apf::getSIMField(chef::extractField(src_m,"solution","velocity",2,apf::VECTOR,1));
-    src_sol_fld[2] = apf::getSIMField(chef::extractField(src_m,"solution","temperature",5,apf::SCALAR,1));
+    apf::Field* src_sol_fld0 = chef::extractField(src_m,"solution","pressure",1,apf::SCALAR,1);
+    apf::Field* src_sol_fld1 = chef::extractField(src_m,"solution","velocity",2,apf::VECTOR,1);
+    apf::Field* src_sol_fld2 = chef::extractField(src_m,"solution","temperature",5,apf::SCALAR,1);
     apf::destroyField(src_m->findField("solution"));
 
     // load fields from the destination mesh
@@ -116,11 +197,13 @@ namespace {
     PCU_ALWAYS_ASSERT(dst_vms_fld);
     PCU_ALWAYS_ASSERT(apf::countComponents(dst_vms_fld) == 5);
 
-    // create efficiency fields on destination mesh
+    // create efficiency fields on destination mesh, for both norms and
+    // for the norm asked for under the plain names
     int nsd = dst_m->getDimension();
-    apf::Field* p_eff_fld = apf::createField(dst_m,"pressure_efficiency",apf::SCALAR,apf::getConstant(nsd));
-    apf::Field* v_eff_fld = apf::createField(dst_m,"velocity_efficiency",apf::VECTOR,apf::getConstant(nsd));
-    apf::Field* t_eff_fld = apf::createField(dst_m,"temperature_efficiency",apf::SCALAR,apf::getConstant(nsd));
+    EfficiencyFields eff_flds[3];
+    eff_flds[0] = createEfficiencyFields(dst_m,"_L2");
+    eff_flds[1] = createEfficiencyFields(dst_m,"_H1");
+    eff_flds[2] = createEfficiencyFields(dst_m,"");
     PCU_Barrier();
 
     // load src model and mesh
@@ -142,7 +225,6 @@ namespace {
     GRIter_delete(grIter);
     GEntMeshMigrator_run(gmig, progress);
     GEntMeshMigrator_delete(gmig);
-    pMesh src_mesh = PM_mesh(src_ppm,0);
 
     // load dest model and mesh
     apf::MeshSIM* dst_apf_msim = dynamic_cast<apf::MeshSIM*>(dst_m);
@@ -160,182 +242,162 @@ namespace {
     GRIter_delete(grIter);
     GEntMeshMigrator_run(gmig, progress);
     GEntMeshMigrator_delete(gmig);
-    pMesh dst_mesh = PM_mesh(dst_ppm,0);
 
-    // delcaration
-    double searchFactor = 0.5; // need to be as user's input
-    pGRegion src_modelRegion;
-    pGRegion dst_modelRegion;
-    pRegion dst_meshRegion;
-    pEdge dst_meshEdge;
-    pVertex dst_meshVertex;
-    pPList deList = PList_new();
+    // build (or read back) the point locator of the reference mesh
+    pc::PointLocator* locator = pc::buildPointLocator(src_m, locatorCache);
+
+    // elements of the destination mesh, evaluated independently
+    std::vector<apf::MeshEntity*> elms;
+    elms.reserve(dst_m->count(nsd));
     apf::MeshEntity* dst_r;
-    apf::MeshElement* dst_elm;
-    apf::Element* dst_fd_elm;
-    apf::Vector3 qpt;
-    apf::Vector3 xyz;
-    apf::Matrix3x3 J;
-    double weight;
-    double Jdet;
-    double p_err_total = 0.0;
-    double p_vms_total = 0.0;
-    double v_err_total[3] = {0.0, 0.0, 0.0};
-    double v_vms_total[3] = {0.0, 0.0, 0.0};
-    double t_err_total = 0.0;
-    double t_vms_total = 0.0;
-
-    // loop over model regions
-    grIter = GM_regionIter(src_model);
-    while((src_modelRegion = GRIter_next(grIter))){
-    // add model region to domain
-      pGDomain gdom = GDomain_new();
-      GDomain_addModelEntity(gdom, src_modelRegion, 1);
-
-    // start mesh region finder
-      pMeshRegionFinder mrf = MeshRegionFinder_new(src_mesh, 1.0, gdom, progress);
-
-    // we assume that the "same" model region has the same tag
-      dst_modelRegion = (pGRegion) GM_entityByTag(dst_model, 3, GEN_tag(src_modelRegion));
-
-    // loop over destination mesh regions
-      RIter rIter = M_classifiedRegionIter(dst_mesh, dst_modelRegion);
-      while((dst_meshRegion = RIter_next(rIter))){
-        dst_r = reinterpret_cast<apf::MeshEntity*>(dst_meshRegion);
-    // calculate shortest edge in this element
-        double min = pc::getShortestEdgeLength(dst_m,dst_r);
-        double tol = searchFactor * min;
-    // loop over quadrature points
-        dst_elm = apf::createMeshElement(dst_m,dst_r);
+    apf::MeshIterator* rit = dst_m->begin(nsd);
+    while((dst_r = dst_m->iterate(rit)))
+      elms.push_back(dst_r);
+    dst_m->end(rit);
+    int numElms = elms.size();
+
+    // squared errors per element: [norm][variable], norm 0 is L2, 1 is H1
+    std::vector<double> elmErr(numElms*2*numVars, 0.0);
+    apf::Field* src_flds[3] = {src_sol_fld0, src_sol_fld1, src_sol_fld2};
+    apf::Field* dst_flds[3] = {dst_sol_fld0, dst_sol_fld1, dst_sol_fld2};
+    double searchFactor = 0.5; // need to be as user's input
+    int notFound = 0;
+
+    // the Simmetrix mesh and field queries are not thread safe, so the
+    // quadrature values of all elements are gathered serially into dense
+    // arrays; qptOffsets[el] is the first point of element el
+    std::vector<int> qptOffsets(numElms+1, 0);
+    std::vector<double> qptWdv;
+    std::vector<char> qptFound;
+    std::vector<double> dstVals, srcVals, dstGrads, srcGrads;
+    {
+      QuadratureBatch dst_q;
+      QuadratureBatch src_q;
+      std::vector<apf::MeshEntity*> found;
+      apf::MeshEntity* hint = 0; // last located element, where the next walk starts
+      for (int el = 0; el < numElms; el++) {
+        apf::MeshEntity* e = elms[el];
+        int tag = dst_m->getModelTag(dst_m->toModel(e));
+        double tol = searchFactor * pc::getShortestEdgeLength(dst_m,e);
+
+    // all quadrature points of this element in one batch
+        apf::MeshElement* dst_elm = apf::createMeshElement(dst_m,e);
         int numqpt = apf::countIntPoints(dst_elm,integrationOrder);
-        double p_err_elm = 0.0;
-        apf::Vector3 v_err_elm = apf::Vector3(0.0, 0.0, 0.0);
-        double t_err_elm = 0.0;
-        apf::Element* dst_sol_fd_elm0 = apf::createElement(dst_sol_fld0,dst_elm);
-        apf::Element* dst_sol_fd_elm1 = apf::createElement(dst_sol_fld1,dst_elm);
-        apf::Element* dst_sol_fd_elm2 = apf::createElement(dst_sol_fld2,dst_elm);
+        dst_q.resize(numqpt);
+        src_q.resize(numqpt);
+        found.assign(numqpt, 0);
         for(int i=0;i<numqpt;i++){
-          apf::getIntPoint(dst_elm,integrationOrder,i,qpt);
-          weight = apf::getIntWeight(dst_elm,integrationOrder,i);
-          apf::getJacobian(dst_elm,qpt,J);
+          apf::Vector3 xyz;
+          apf::Matrix3x3 J;
+          apf::getIntPoint(dst_elm,integrationOrder,i,dst_q.xi[i]);
+          apf::getJacobian(dst_elm,dst_q.xi[i],J);
           J = apf::transpose(J); //Unique to PUMI implementation
           if(nsd==2) J[2][2] = 1.0;
-          Jdet = fabs(apf::getJacobianDeterminant(J,nsd));
-          apf::mapLocalToGlobal(dst_elm,qpt,xyz);
+          dst_q.wdv[i] = apf::getIntWeight(dst_elm,integrationOrder,i) *
+                         fabs(apf::getJacobianDeterminant(J,nsd));
+          apf::mapLocalToGlobal(dst_elm,dst_q.xi[i],xyz);
     // find this location in reference mesh
-          const double loc[3] = {xyz[0], xyz[1], xyz[2]};
-          double params[3] = {0.0, 0.0, 0.0};
-          double dist[1] = {0.0};
-          pRegion foundMR = MeshRegionFinder_find(mrf, loc, params, dist);
-          if(foundMR && (dist[0] < tol)) {
-    // declare interpolation element for source mesh
-            pInterp intp0 = Field_entInterp(src_sol_fld[0], foundMR);
-            pInterp intp1 = Field_entInterp(src_sol_fld[1], foundMR);
-            pInterp intp2 = Field_entInterp(src_sol_fld[2], foundMR);
-
-            if (normOptInt == 2) {
-    // get value from destination mesh
-              double dst_sol_p = apf::getScalar(dst_sol_fd_elm0,qpt);
-              apf::Vector3 dst_sol_v = {0.0, 0.0, 0.0};
-              apf::getVector(dst_sol_fd_elm1,qpt,dst_sol_v);
-              double dst_sol_t = apf::getScalar(dst_sol_fd_elm2,qpt);
-    // get value from source mesh
-              double* src_sol_p = new double[1];
-              double* src_sol_v = new double[3];
-              double* src_sol_t = new double[1];
-              Interp_deriv0(intp0, params, 0, src_sol_p);
-              Interp_deriv0(intp1, params, 0, src_sol_v);
-              Interp_deriv0(intp2, params, 0, src_sol_t);
-    // calculate pressure true error
-              p_err_elm += (dst_sol_p - src_sol_p[0])*(dst_sol_p - src_sol_p[0])*weight*Jdet;
-    // calculate velocity true error
-              v_err_elm[0] += (dst_sol_v[0] - src_sol_v[0])*(dst_sol_v[0] - src_sol_v[0])*weight*Jdet;
-              v_err_elm[1] += (dst_sol_v[1] - src_sol_v[1])*(dst_sol_v[1] - src_sol_v[1])*weight*Jdet;
-              v_err_elm[2] += (dst_sol_v[2] - src_sol_v[2])*(dst_sol_v[2] - src_sol_v[2])*weight*Jdet;
-    // calculate temperature true error
-              t_err_elm += (dst_sol_t - src_sol_t[0])*(dst_sol_t - src_sol_t[0])*weight*Jdet;
-            }
-            else if (normOptInt == 1) {
-    // get gradient value from destination mesh
-              apf::Vector3 dst_sol_dp = {0.0, 0.0, 0.0};
-              apf::getGrad(dst_sol_fd_elm0,qpt,dst_sol_dp);
-              apf::Matrix3x3 dst_sol_dv;
-              apf::getVectorGrad(dst_sol_fd_elm1,qpt,dst_sol_dv);
-              apf::Vector3 dst_sol_dt = {0.0, 0.0, 0.0};
-              apf::getGrad(dst_sol_fd_elm2,qpt,dst_sol_dt);
-    // get gradient value from source mesh
-              double* src_sol_dp = new double[3];
-              double* src_sol_dv = new double[9];
-              double* src_sol_dt = new double[3];
-              Interp_deriv1(intp0, params, 0, src_sol_dp);
-              Interp_deriv1(intp1, params, 0, src_sol_dv);
-              Interp_deriv1(intp2, params, 0, src_sol_dt);
-              for(int j=0; j< 3; j++){ // derivative index
-    // calculate pressure true error
-                p_err_elm += (dst_sol_dp[j]-src_sol_dp[j])*(dst_sol_dp[j]-src_sol_dp[j])*weight*Jdet;
-    // calculate velocity true error
-                for(int k=0; k<3; k++){ // vector index
-                  v_err_elm[k]+=(dst_sol_dv[j][k]-src_sol_dv[k*3+j])*(dst_sol_dv[j][k]-src_sol_dv[k*3+j])*weight*Jdet;
-                }
-    // calculate temperature true error
-                t_err_elm += (dst_sol_dt[j]-src_sol_dt[j])*(dst_sol_dt[j]-src_sol_dt[j])*weight*Jdet;
-              }
-            }
-            Interp_delete(intp0);
-            Interp_delete(intp1);
-            Interp_delete(intp2);
+          double dist;
+          found[i] = pc::locatePointFrom(locator, xyz, tag, hint, src_q.xi[i], dist);
+          if (found[i])
+            hint = found[i];
+          if (!found[i] || !(dist < tol)) {
+            found[i] = 0;
+            notFound++;
           }
-          else {
-            if (foundMR == 0)
-              printf("cannot find mesh region by point (%f,%f,%f)\n",loc[0],loc[1],loc[2]);
-            else
-              printf("dist %f is larger than tol %f\n",dist[0],tol);
-          } // end if found mesh region
-        } // end loop over quadrature points
-    // calculate local efficiency and store in a field
-        apf::NewArray<double> vms_elm(apf::countComponents(dst_vms_fld));
-        apf::getComponents(dst_vms_fld,dst_r,0,&(vms_elm[0]));
-        apf::setScalar(p_eff_fld,dst_r,0,vms_elm[0]/sqrt(p_err_elm));
-        apf::Vector3 v_eff_elm = apf::Vector3(vms_elm[1]/sqrt(v_err_elm[0]),
-                                              vms_elm[2]/sqrt(v_err_elm[1]),
-                                              vms_elm[3]/sqrt(v_err_elm[2]));
-        apf::setVector(v_eff_fld,dst_r,0,v_eff_elm);
-        apf::setScalar(t_eff_fld,dst_r,0,vms_elm[4]/sqrt(t_err_elm));
-    // record global variables
-        p_err_total    += p_err_elm;
-        p_vms_total    += vms_elm[0]*vms_elm[0];
-        v_err_total[0] += v_err_elm[0];
-        v_vms_total[0] += vms_elm[1]*vms_elm[1];
-        v_err_total[1] += v_err_elm[1];
-        v_vms_total[1] += vms_elm[2]*vms_elm[2];
-        v_err_total[2] += v_err_elm[2];
-        v_vms_total[2] += vms_elm[3]*vms_elm[3];
-        t_err_total    += t_err_elm;
-        t_vms_total    += vms_elm[4]*vms_elm[4];
-      } // end loop over mesh regions
-      RIter_delete(rIter);
-      MeshRegionFinder_delete(mrf);
-      GDomain_delete(gdom);
-    } // end loop over model regions
-    GRIter_delete(grIter);
+        }
+        evaluateBatch(dst_elm, dst_flds, dst_q, 0, numqpt);
+        apf::destroyMeshElement(dst_elm);
+
+    // source values, one batch per run of points in the same element
+        std::fill(src_q.vals.begin(), src_q.vals.end(), 0.0);
+        std::fill(src_q.grads.begin(), src_q.grads.end(), 0.0);
+        for (int i = 0; i < numqpt;) {
+          int j = i + 1;
+          while (j < numqpt && found[j] == found[i])
+            j++;
+          if (found[i]) {
+            apf::MeshElement* src_elm = apf::createMeshElement(src_m,found[i]);
+            evaluateBatch(src_elm, src_flds, src_q, i, j);
+            apf::destroyMeshElement(src_elm);
+          }
+          i = j;
+        }
+
+        qptOffsets[el+1] = qptOffsets[el] + numqpt;
+        qptWdv.insert(qptWdv.end(), dst_q.wdv.begin(), dst_q.wdv.end());
+        for (int i = 0; i < numqpt; i++)
+          qptFound.push_back(found[i] != 0);
+        dstVals.insert(dstVals.end(), dst_q.vals.begin(), dst_q.vals.end());
+        srcVals.insert(srcVals.end(), src_q.vals.begin(), src_q.vals.end());
+        dstGrads.insert(dstGrads.end(), dst_q.grads.begin(), dst_q.grads.end());
+        srcGrads.insert(srcGrads.end(), src_q.grads.begin(), src_q.grads.end());
+      }
+    }
+
+    // accumulate the L2 and H1 (gradient) errors together; only this
+    // arithmetic over the dense arrays is threaded
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(threads)
+#endif
+    for (int el = 0; el < numElms; el++) {
+      double* err = &elmErr[el*2*numVars];
+      for (int i = qptOffsets[el]; i < qptOffsets[el+1]; i++) {
+        if (!qptFound[i])
+          continue;
+        for (int v = 0; v < numVars; v++) {
+          double d = dstVals[i*numVars+v] - srcVals[i*numVars+v];
+          err[v] += d*d*qptWdv[i];
+          for (int k = 0; k < 3; k++) {
+            int g = (i*numVars+v)*3+k;
+            double dg = dstGrads[g] - srcGrads[g];
+            err[numVars+v] += dg*dg*qptWdv[i];
+          }
+        }
+      }
+    }
+    pc::destroyPointLocator(locator);
+    notFound = PCU_Add_Int(notFound);
+    if (!PCU_Comm_Self() && notFound)
+      printf("%d quadrature points were not found within tolerance in the reference mesh\n", notFound);
+
+    // set local efficiency fields and record global variables
+    const char* normNames[2] = {"L2", "H1"};
+    double err_total[2][numVars];
+    double vms_total[numVars];
+    for (int v = 0; v < numVars; v++) {
+      err_total[0][v] = err_total[1][v] = 0.0;
+      vms_total[v] = 0.0;
+    }
+    apf::NewArray<double> vms_elm(apf::countComponents(dst_vms_fld));
+    for (int el = 0; el < numElms; el++) {
+      apf::getComponents(dst_vms_fld,elms[el],0,&(vms_elm[0]));
+      for (int v = 0; v < numVars; v++)
+        vms_total[v] += vms_elm[v]*vms_elm[v];
+      for (int n = 0; n < 2; n++) {
+        const double* err = &elmErr[(el*2+n)*numVars];
+        for (int v = 0; v < numVars; v++)
+          err_total[n][v] += err[v];
+        setEfficiency(eff_flds[n], elms[el], &vms_elm[0], err);
+        if (n == 2 - normOptInt)
+          setEfficiency(eff_flds[2], elms[el], &vms_elm[0], err);
+      }
+    }
 
     // communicate global variables
-    PCU_Add_Doubles(&p_err_total,1);
-    PCU_Add_Doubles(&p_vms_total,1);
-    PCU_Add_Doubles(&(v_err_total[0]),3);
-    PCU_Add_Doubles(&(v_vms_total[0]),3);
-    PCU_Add_Doubles(&t_err_total,1);
-    PCU_Add_Doubles(&t_vms_total,1);
+    PCU_Add_Doubles(&err_total[0][0],2*numVars);
+    PCU_Add_Doubles(vms_total,numVars);
     PCU_Barrier();
 
     // print global efficiency
     if (!PCU_Comm_Self()) {
-      printf("global efficiency (p,u,v,w,t): %f, %f, %f, %f, %f\n",
-                            sqrt(p_vms_total)/sqrt(p_err_total),
-                            sqrt(v_vms_total[0])/sqrt(v_err_total[0]),
-                            sqrt(v_vms_total[1])/sqrt(v_err_total[1]),
-                            sqrt(v_vms_total[2])/sqrt(v_err_total[2]),
-                            sqrt(t_vms_total)/sqrt(t_err_total));
+      for (int n = 0; n < 2; n++)
+        printf("global %s efficiency (p,u,v,w,t): %f, %f, %f, %f, %f\n", normNames[n],
+                              sqrt(vms_total[0])/sqrt(err_total[n][0]),
+                              sqrt(vms_total[1])/sqrt(err_total[n][1]),
+                              sqrt(vms_total[2])/sqrt(err_total[n][2]),
+                              sqrt(vms_total[3])/sqrt(err_total[n][3]),
+                              sqrt(vms_total[4])/sqrt(err_total[n][4]));
     }
 
     // partition the dst mesh
@@ -357,15 +419,29 @@ int main(int argc, char** argv) {
   MPI_Init(&argc, &argv);
   PCU_Comm_Init();
   PCU_Protect();
-  if( argc != 5 ) {
+  bool cache = false;
+  int threads = 1;
+  bool badArgs = argc < 5;
+  for (int i = 5; i < argc && !badArgs; i++) {
+    if (!strcmp(argv[i], "-cache"))
+      cache = true;
+    else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else
+      badArgs = true;
+  }
+  if( badArgs || threads < 1 ) {
     if(!PCU_Comm_Self())
-      fprintf(stderr, "Usage: %s <refer_mesh.sms> <refer_restart_dir> <norm(1:H1/2:L2)> <p_order>\n",argv[0]);
+      fprintf(stderr, "Usage: %s <refer_mesh.sms> <refer_restart_dir> <norm(1:H1/2:L2)> <p_order> [-cache] [-threads <N>]\n"
+                      "  -cache      keep the reference point locator next to the reference mesh\n"
+                      "  -threads N  OpenMP threads per rank for the error sums (default: 1)\n",argv[0]);
     exit(EXIT_FAILURE);
   }
   const char* referMeshFile   = argv[1];
   const char* referRestartDir = argv[2];
   normOptInt = atoi(argv[3]);
   integrationOrder = atoi(argv[4]);
+  const char* locatorCache = cache ? referMeshFile : 0;
   if (normOptInt < 1 || normOptInt > 2) {
     if(!PCU_Comm_Self())
       fprintf(stderr, "Usage: integer argument <norm(H1/L2)> should be 1 (H1) or 2 (L2)\n",argv[0]);
@@ -404,7 +480,7 @@ int main(int argc, char** argv) {
   clearGRStream(ref_grs);
 
   /* calculate the efficiency */
-  calculateEfficiency(ref_ctrl, ref_m, ctrl, m);
+  calculateEfficiency(ref_ctrl, ref_m, ctrl, m, locatorCache, threads);
 
   clearRStream(rs);
   clearRStream(ref_rs);
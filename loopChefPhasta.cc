@@ -29,6 +29,8 @@
 #include "pcWriteFiles.h"
 #include "pcUpdateMesh.h"
 #include "pcAdapter.h"
+#include "pcQuality.h"
+#include "pcInput.h"
 
 namespace {
   void freeMesh(apf::Mesh* m) {
@@ -96,7 +98,19 @@ int main(int argc, char** argv) {
   ctrl.rs = rs;
   /* load input file for solver */
   phSolver::Input inp("solver.inp", "input.config");
+  pc::QualityLimits limits = pc::getQualityLimits(inp);
+  pc::QualityMonitor* qm = pc::createQualityMonitor();
+  /* prescribed motion from a schedule file instead of the solver */
+  std::string scheduleFile = pc::getOptionalString(inp, "Motion Schedule File", "");
+  pc::MotionSchedule* schedule = 0;
+  if (!scheduleFile.empty()) {
+    schedule = pc::loadMotionSchedule(scheduleFile.c_str(), maxStep, ctrl.timeStepNumber);
+    if (!schedule)
+      exit(EXIT_FAILURE);
+    pc::setMotionSchedule(schedule);
+  }
   pc::writeSequence(m,0,"init_");
+  pc::updateQualityMonitor(qm, m);
   int step = 0; int old_step = 0;
   do {
     m->verify();
@@ -114,8 +128,8 @@ int main(int argc, char** argv) {
       break;
     setupChef(ctrl,step);
     chef::readAndAttachFields(ctrl,m);
-    /* perform mesh mover + improver + adapter */
-    pc::updateMesh(ctrl,m,szFld,step,ctrl.simCooperation);
+    /* perform mesh mover + improver + adapter as needed, or remesh */
+    pc::updateMeshOrRemesh(ctrl,m,szFld,step,ctrl.simCooperation,limits,qm);
     chef::preprocess(m,ctrl,grs);
     clearRStream(rs);
     double t1 = PCU_Time();
@@ -124,6 +138,11 @@ int main(int argc, char** argv) {
   } while( step < maxStep );
   destroyGRStream(grs);
   destroyRStream(rs);
+  pc::destroyQualityMonitor(qm);
+  if (schedule) {
+    pc::setMotionSchedule(0);
+    pc::destroyMotionSchedule(schedule);
+  }
   freeMesh(m);
   chefPhasta::finalizeModelers(ctrl.writeSimLog);
   PCU_Comm_Free();
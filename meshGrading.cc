@@ -14,6 +14,8 @@
 #include <sam.h>
 #include <phastaChef.h>
 #include <apfMDS.h>
+#include <apfPartition.h>
+#include <parma.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include "lionPrint.h"
@@ -29,15 +31,147 @@
 #include <SimDiscrete.h>
 
 #include "pcSmooth.h"
+#include "pcUpdateMesh.h"
 
 #include <cstring>
 #include <cassert>
+#include <string>
+#include <vector>
+#include <sstream>
 
 namespace {
   void freeMesh(apf::Mesh* m) {
     m->destroyNative();
     apf::destroyMesh(m);
   }
+
+  void printUsage(const char* exe) {
+    if(!PCU_Comm_Self())
+      fprintf(stderr, "Usage: %s <model> <mesh.sms|mesh.smb> <graded_mesh> "
+                      "<gradation factor[,factor,...]> [-async] [-inparts <N>] [-threads <N>]\n"
+                      "  -async       grade with asynchronous boundary exchange\n"
+                      "  -threads N   OpenMP threads per rank for on-part grading\n"
+                      "               (default: 1)\n"
+                      "  -inparts N   number of parts in an MDS input mesh\n"
+                      "               (default: number of ranks)\n", exe);
+  }
+
+  std::vector<std::string> splitFactors(const char* arg) {
+    std::vector<std::string> factors;
+    std::stringstream ss(arg);
+    std::string f;
+    while (std::getline(ss, f, ','))
+      if (!f.empty())
+        factors.push_back(f);
+    return factors;
+  }
+
+  /* graded_mesh.sms -> graded_mesh_1.5.sms when grading with several factors */
+  std::string outputName(const char* out, std::string const& factor,
+                         bool batch, const char* newExt = 0) {
+    std::string name(out);
+    std::string ext;
+    std::size_t dot = name.rfind('.');
+    if (dot != std::string::npos && name.find('/', dot) == std::string::npos) {
+      ext = name.substr(dot);
+      name = name.substr(0, dot);
+    }
+    if (batch)
+      name += "_" + factor;
+    return name + (newExt ? std::string(newExt) : ext);
+  }
+
+  void printImbalance(apf::Mesh* m) {
+    double elms = m->count(m->getDimension());
+    double maxElms = PCU_Max_Double(elms);
+    double totElms = PCU_Add_Double(elms);
+    if(!PCU_Comm_Self())
+      printf("Elements: %.0f total, element imbalance %f\n",
+             totElms, maxElms / (totElms / PCU_Comm_Peers()));
+  }
+
+  /* load a serial or partitioned .sms onto all ranks */
+  apf::Mesh2* loadSimMesh(pGModel model, const char* meshFile, pProgress progress) {
+    pParMesh pmesh = PM_load(meshFile, model, progress);
+    int numParts = PM_totalNumParts(pmesh);
+    if (numParts != PCU_Comm_Peers()) {
+      if(!PCU_Comm_Self())
+        printf("partition %d-part mesh to %d parts\n", numParts, PCU_Comm_Peers());
+      pPartitionOpts pOpts = PartitionOpts_new();
+      PartitionOpts_setTotalNumParts(pOpts, PCU_Comm_Peers());
+      PartitionOpts_setProcWtEqual(pOpts);
+      PM_partition(pmesh, pOpts, progress);
+      PartitionOpts_delete(pOpts);
+    }
+    else {
+      pc::balanceEqualWeights(pmesh, progress);
+    }
+    return apf::createMesh(pmesh);
+  }
+
+  /* load an MDS mesh with inParts parts onto all ranks; when there are
+     fewer parts than ranks, each part is split by recursive inertial
+     bisection on its own group of ranks and the result is repeated
+     out to every rank */
+  apf::Mesh2* loadAndSplitMdsMesh(gmi_model* g, const char* meshFile, int inParts) {
+    int peers = PCU_Comm_Peers();
+    if (inParts == peers) {
+      apf::Mesh2* m = apf::loadMdsMesh(g, meshFile);
+      apf::Balancer* balancer = Parma_MakeElmBalancer(m);
+      balancer->balance(NULL, 1.05);
+      delete balancer;
+      return m;
+    }
+    if (peers % inParts) {
+      if(!PCU_Comm_Self())
+        fprintf(stderr, "Error: %d ranks is not a multiple of %d input parts\n",
+                peers, inParts);
+      exit(EXIT_FAILURE);
+    }
+    int factor = peers / inParts;
+    int self = PCU_Comm_Self();
+    bool isOriginal = (self % factor == 0);
+    MPI_Comm groupComm;
+    MPI_Comm_split(MPI_COMM_WORLD, self % factor, self / factor, &groupComm);
+    PCU_Switch_Comm(groupComm);
+    apf::Mesh2* m = 0;
+    apf::Migration* plan = 0;
+    if (isOriginal) {
+      m = apf::loadMdsMesh(g, meshFile);
+      apf::Splitter* splitter = Parma_MakeRibSplitter(m);
+      plan = splitter->split(NULL, 1.05, factor);
+      delete splitter;
+    }
+    PCU_Switch_Comm(MPI_COMM_WORLD);
+    MPI_Comm_free(&groupComm);
+    return apf::repeatMdsMesh(m, g, plan, factor);
+  }
+
+  /* the isotropic size of the current mesh is the field being graded */
+  apf::Field* attachSizeField(apf::Mesh2* m, bool isSim) {
+    if (m->findField("sizes"))
+      apf::destroyField(m->findField("sizes"));
+    apf::Field* sizes;
+    if (isSim) {
+      sizes = apf::createSIMFieldOn(m, "sizes", apf::VECTOR);
+      apf::Field* frames = apf::createSIMFieldOn(m, "frames", apf::MATRIX);
+      ph::attachSIMSizeField(m, sizes, frames);
+      apf::destroyField(frames);
+    }
+    else {
+      sizes = apf::createFieldOn(m, "sizes", apf::VECTOR);
+      apf::Field* iso = samSz::isoSize(m);
+      apf::MeshEntity* v;
+      apf::MeshIterator* vit = m->begin(0);
+      while ((v = m->iterate(vit))) {
+        double h = apf::getScalar(iso, v, 0);
+        apf::setVector(sizes, v, 0, apf::Vector3(h, h, h));
+      }
+      m->end(vit);
+      apf::destroyField(iso);
+    }
+    return sizes;
+  }
 } //end namespace
 
 int main(int argc, char** argv) {
@@ -45,30 +179,94 @@ int main(int argc, char** argv) {
   PCU_Comm_Init();
   PCU_Protect();
   lion_set_verbosity(1);
-  if( argc != 5 ) {
-    if(!PCU_Comm_Self())
-      fprintf(stderr, "Usage: %s <model.smd> <mesh.sms> <graded_mesh.sms> <gradation factor>\n",argv[0]);
+  if( argc < 5 ) {
+    printUsage(argv[0]);
     exit(EXIT_FAILURE);
   }
   const char* modelFilename = argv[1];
   const char* meshFilename = argv[2];
   const char* outputFilename = argv[3];
-  double gradingFactor = atof(argv[4]);
+  std::vector<std::string> factors = splitFactors(argv[4]);
+  bool async = false;
+  int inParts = PCU_Comm_Peers();
+  int threads = 1;
+  for (int i = 5; i < argc; i++) {
+    if (!strcmp(argv[i], "-async"))
+      async = true;
+    else if (!strcmp(argv[i], "-inparts") && i + 1 < argc)
+      inParts = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+      threads = atoi(argv[++i]);
+    else {
+      printUsage(argv[0]);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (factors.empty() || inParts < 1 || threads < 1) {
+    printUsage(argv[0]);
+    exit(EXIT_FAILURE);
+  }
+  bool batch = factors.size() > 1;
   chefPhasta::initModelers();
   pProgress progress = Progress_new();
   Progress_setDefaultCallback(progress);
 
-  // load mesh and model
-  pGModel model = GM_load(modelFilename, NULL, progress);
-  pParMesh pmesh = PM_load(meshFilename, model, progress);
-  apf::Mesh2* m = apf::createMesh(pmesh);
+  // load model and mesh once for all factors
+  double t0 = PCU_Time();
+  bool isSim = ph::mesh_has_ext(meshFilename, "sms");
+  apf::Mesh2* m = 0;
+  pGModel model = 0;
+  if (isSim) {
+    model = GM_load(modelFilename, NULL, progress);
+    m = loadSimMesh(model, meshFilename, progress);
+  }
+  else {
+    gmi_model* g = gmi_load(modelFilename);
+    m = loadAndSplitMdsMesh(g, meshFilename, inParts);
+  }
+  double t1 = PCU_Time();
+  if(!PCU_Comm_Self())
+    printf("mesh loaded and balanced in %f seconds\n", t1 - t0);
+  printImbalance(m);
+
+  // keep the ungraded sizes so every factor starts from the same field
+  apf::Field* sizes = attachSizeField(m, isSim);
+  apf::Field* orgSizes = apf::createFieldOn(m, "org_sizes", apf::VECTOR);
+  apf::copyData(orgSizes, sizes);
+
+  // gradation only changes the size field, so a SIM mesh is written once
+  if (isSim) {
+    apf::MeshSIM* sim_m = dynamic_cast<apf::MeshSIM*>(m);
+    PM_write(sim_m->getMesh(), outputFilename, progress);
+  }
+  for (std::size_t i = 0; i < factors.size(); i++) {
+    double gradingFactor = atof(factors[i].c_str());
+    if (i)
+      apf::copyData(sizes, orgSizes);
 
-  // apply mesh gradation
-  pc::meshGradation(m, gradingFactor);
+    // apply mesh gradation
+    double t2 = PCU_Time();
+    pc::meshGradation(m, gradingFactor, async, threads);
+    double t3 = PCU_Time();
+    double gradeTime = PCU_Max_Double(t3 - t2);
+    if(!PCU_Comm_Self())
+      printf("gradation factor %s done in %f seconds\n",
+             factors[i].c_str(), gradeTime);
 
-  // write out mesh
-  PM_write(pmesh, outputFilename, progress);
+    // write out partitioned result
+    if (isSim) {
+      std::string fld = outputName(outputFilename, factors[i], batch, ".fld");
+      Field_write(apf::getSIMField(sizes), fld.c_str(), 0, NULL, progress);
+    }
+    else {
+      std::string out = outputName(outputFilename, factors[i], batch);
+      m->writeNative(out.c_str());
+    }
+  }
+  if(!PCU_Comm_Self())
+    printf("total time %f seconds\n", PCU_Time() - t0);
 
+  apf::destroyField(orgSizes);
   freeMesh(m);
   Progress_delete(progress);
   chefPhasta::finalizeModelers();
@@ -3,6 +3,8 @@
 #include "pcUpdateMesh.h"
 #include "pcSmooth.h"
 #include "pcWriteFiles.h"
+#include "pcInput.h"
+#include "pcBalance.h"
 #include <SimUtil.h>
 #include <SimPartitionedMesh.h>
 #include <SimDiscrete.h>
@@ -17,35 +19,93 @@
 #include <maStats.h>
 #include <apfShape.h>
 #include <math.h>
+#include <cstring>
 
 extern void MSA_setBLSnapping(pMSAdapt, int onoff);
 
 namespace pc {
 
-  apf::Field* convertField(apf::Mesh* m,
-    const char* inFieldname,
-    const char* outFieldname) {
-    apf::Field* inf = m->findField(inFieldname);
-    assert(inf);
-    int size = apf::countComponents(inf);
-    apf::Field* outf = m->findField(outFieldname);
-    if (outf)
-      apf::destroyField(outf);
-    outf = apf::createPackedField(m, outFieldname, size);
-    apf::NewArray<double> inVal(size);
-    apf::NewArray<double> outVal(size);
+  /* a range of components of a packed vertex field */
+  struct FieldPart {
+    const char* name;
+    int first;
+    int valueType;
+  };
+
+  const FieldPart solutionParts[3] = {
+    {"pressure", 0, apf::SCALAR},
+    {"velocity", 1, apf::VECTOR},
+    {"temperature", 4, apf::SCALAR}};
+
+  const FieldPart derivativeParts[3] = {
+    {"der_pressure", 0, apf::SCALAR},
+    {"der_velocity", 1, apf::VECTOR},
+    {"der_temperature", 4, apf::SCALAR}};
+
+  const FieldPart meshVelPart = {"mesh_vel_sim", 0, apf::VECTOR};
+
+  const FieldPart ctcnPart = {"ctcn_elm_sim", 0, apf::SCALAR};
+
+  /* split a packed vertex field into its parts in one sweep over the
+     vertices and destroy it right away, so the packed copy and the
+     parts only coexist for the length of the sweep */
+  void splitField(apf::Mesh* m, const char* packedName,
+                  const FieldPart* parts, int numParts,
+                  int simFlag, pField* sim_flds) {
+    apf::Field* packed = m->findField(packedName);
+    assert(packed);
+    int size = apf::countComponents(packed);
+    apf::NewArray<apf::Field*> fs(numParts);
+    for (int i = 0; i < numParts; i++) {
+      if (m->findField(parts[i].name))
+        apf::destroyField(m->findField(parts[i].name));
+      if (simFlag)
+        fs[i] = apf::createSIMFieldOn(m, parts[i].name, parts[i].valueType);
+      else
+        fs[i] = apf::createFieldOn(m, parts[i].name, parts[i].valueType);
+    }
+    apf::NewArray<double> vals(size);
     apf::MeshEntity* vtx;
     apf::MeshIterator* it = m->begin(0);
     while ((vtx = m->iterate(it))) {
-      apf::getComponents(inf, vtx, 0, &inVal[0]);
-      for (int i = 0; i < size; i++){
-        outVal[i] = inVal[i];
-      }
-      apf::setComponents(outf,vtx, 0, &outVal[0]);
+      apf::getComponents(packed, vtx, 0, &vals[0]);
+      for (int i = 0; i < numParts; i++)
+        apf::setComponents(fs[i], vtx, 0, &vals[parts[i].first]);
     }
     m->end(it);
-    apf::destroyField(inf);
-    return outf;
+    apf::destroyField(packed);
+    for (int i = 0; i < numParts; i++)
+      sim_flds[i] = simFlag ? apf::getSIMField(fs[i]) : 0;
+  }
+
+  /* pack the part fields into a new vertex field in one sweep and
+     destroy them */
+  apf::Field* combineFields(apf::Mesh* m, const char* packedName,
+                            const FieldPart* parts, int numParts) {
+    apf::NewArray<apf::Field*> fs(numParts);
+    apf::NewArray<int> first(numParts + 1);
+    first[0] = 0;
+    for (int i = 0; i < numParts; i++) {
+      fs[i] = m->findField(parts[i].name);
+      assert(fs[i]);
+      first[i + 1] = first[i] + apf::countComponents(fs[i]);
+    }
+    apf::Field* packed = m->findField(packedName);
+    if (packed)
+      apf::destroyField(packed);
+    packed = apf::createPackedField(m, packedName, first[numParts]);
+    apf::NewArray<double> vals(first[numParts]);
+    apf::MeshEntity* vtx;
+    apf::MeshIterator* it = m->begin(0);
+    while ((vtx = m->iterate(it))) {
+      for (int i = 0; i < numParts; i++)
+        apf::getComponents(fs[i], vtx, 0, &vals[first[i]]);
+      apf::setComponents(packed, vtx, 0, &vals[0]);
+    }
+    m->end(it);
+    for (int i = 0; i < numParts; i++)
+      apf::destroyField(fs[i]);
+    return packed;
   }
 
   apf::Field* convertVtxFieldToElm(apf::Mesh* m,
@@ -93,31 +153,57 @@ namespace pc {
     }
   }
 
-  int getNumOfMappedFields(apf::Mesh2*& m) {
-    /* initially, we have 7 fields: pressure, velocity, temperature,
-       time der of pressure, time der of velocity, time der of temperature,
-       ,mesh velocity and 1 optional field: time resource bound factor field */
-    int numOfMappedFields;
-    if (m->findField("ctcn_elm")) numOfMappedFields = 8;
-    else numOfMappedFields = 7;
+  /* a packed field carried through mesh adaptation; it is split into
+     parts for the mapping and packed again as outName afterwards.
+     with a neededKey the field is only mapped when that solver.inp
+     option is nonzero */
+  struct MappedField {
+    const char* name;
+    const FieldPart* parts;
+    int numParts;
+    const char* outName;
+    bool onElements;
+    const char* neededKey;
+  };
+
+  const int numOfRegisteredFields = 4;
+
+  const MappedField mappedFields[numOfRegisteredFields] = {
+    {"solution", solutionParts, 3, "solution", false, 0},
+    {"time derivative of solution", derivativeParts, 3,
+     "time derivative of solution", false, "Map Time Derivative of Solution"},
+    {"mesh_vel", &meshVelPart, 1, "mesh_vel", false, 0},
+    {"ctcn_elm", &ctcnPart, 1, "err_tri_f", true, 0}};
+
+  bool isMappedFieldNeeded(MappedField const& f, phSolver::Input& inp) {
+    if (!f.neededKey)
+      return true;
+    return getOptionalInt(inp, f.neededKey, 1) != 0;
+  }
+
+  MappedField const* findMappedField(apf::Field* f, phSolver::Input& inp) {
+    for (int i = 0; i < numOfRegisteredFields; i++)
+      if (!strcmp(apf::getName(f), mappedFields[i].name))
+        return isMappedFieldNeeded(mappedFields[i], inp) ? &mappedFields[i] : 0;
+    return 0;
+  }
+
+  int getNumOfMappedFields(apf::Mesh2*& m, phSolver::Input& inp) {
+    int numOfMappedFields = 0;
+    for (int i = 0; i < numOfRegisteredFields; i++)
+      if (m->findField(mappedFields[i].name) &&
+          isMappedFieldNeeded(mappedFields[i], inp))
+        numOfMappedFields += mappedFields[i].numParts;
     return numOfMappedFields;
   }
 
-  /* remove all fields except for solution, time
-     derivative of solution, mesh velocity and keep
-     certain field if corresponding option is on */
-  void removeOtherFields(apf::Mesh2*& m, phSolver::Input& inp) {
-    int index = 0;
-    int numOfPackFields = 4;
-    while (m->countFields() > numOfPackFields) {
-      apf::Field* f = m->getField(index);
-      if ( f == m->findField("solution") ||
-           f == m->findField("time derivative of solution") ||
-           f == m->findField("mesh_vel") ||
-           f == m->findField("ctcn_elm") ) {
-        index++;
+  /* remove all fields that are not registered for mapping
+     or not needed this cycle, except keep */
+  void removeOtherFields(apf::Mesh2*& m, phSolver::Input& inp, apf::Field* keep) {
+    for (int i = m->countFields() - 1; i >= 0; i--) {
+      apf::Field* f = m->getField(i);
+      if (f == keep || findMappedField(f, inp))
         continue;
-      }
       m->removeField(f);
       apf::destroyField(f);
     }
@@ -126,44 +212,23 @@ namespace pc {
 
   int getSimFields(apf::Mesh2*& m, int simFlag, pField* sim_flds, phSolver::Input& inp) {
     int num_flds = 0;
-    if (m->findField("solution")) {
-      num_flds += 3;
-      sim_flds[0] = apf::getSIMField(chef::extractField(m,"solution","pressure",1,apf::SCALAR,simFlag));
-      sim_flds[1] = apf::getSIMField(chef::extractField(m,"solution","velocity",2,apf::VECTOR,simFlag));
-      sim_flds[2] = apf::getSIMField(chef::extractField(m,"solution","temperature",5,apf::SCALAR,simFlag));
-      apf::destroyField(m->findField("solution"));
-    }
-
-    if (m->findField("time derivative of solution")) {
-      num_flds += 3;
-      sim_flds[3] = apf::getSIMField(chef::extractField(m,"time derivative of solution","der_pressure",1,apf::SCALAR,simFlag));
-      sim_flds[4] = apf::getSIMField(chef::extractField(m,"time derivative of solution","der_velocity",2,apf::VECTOR,simFlag));
-      sim_flds[5] = apf::getSIMField(chef::extractField(m,"time derivative of solution","der_temperature",5,apf::SCALAR,simFlag));
-      apf::destroyField(m->findField("time derivative of solution"));
-    }
-
-    if (m->findField("mesh_vel")) {
-      num_flds += 1;
-      sim_flds[6] = apf::getSIMField(chef::extractField(m,"mesh_vel","mesh_vel_sim",1,apf::VECTOR,simFlag));
-      apf::destroyField(m->findField("mesh_vel"));
-    }
-
-    if (m->findField("ctcn_elm")) {
-      num_flds += 1;
-      sim_flds[7] = apf::getSIMField(chef::extractField(m,"ctcn_elm","ctcn_elm_sim",1,apf::SCALAR,simFlag));
-      apf::destroyField(m->findField("ctcn_elm"));
+    for (int i = 0; i < numOfRegisteredFields; i++) {
+      MappedField const& f = mappedFields[i];
+      if (!m->findField(f.name) || !isMappedFieldNeeded(f, inp))
+        continue;
+      splitField(m, f.name, f.parts, f.numParts, simFlag, &sim_flds[num_flds]);
+      num_flds += f.numParts;
     }
-
     return num_flds;
   }
 
   /* unpacked solution into serveral fields,
      put these field explicitly into pPList */
-  pPList getSimFieldList(ph::Input& in, apf::Mesh2*& m){
+  pPList getSimFieldList(ph::Input& in, apf::Mesh2*& m, apf::Field* keep){
     /* load input file for solver */
     phSolver::Input inp("solver.inp", "input.config");
-    int num_flds = getNumOfMappedFields(m);
-    removeOtherFields(m,inp);
+    int num_flds = getNumOfMappedFields(m,inp);
+    removeOtherFields(m,inp,keep);
     pField* sim_flds = new pField[num_flds];
     getSimFields(m, in.simmetrixMesh, sim_flds, inp);
     pPList sim_fld_lst = PList_new();
@@ -176,14 +241,15 @@ namespace pc {
   }
 
   void transferSimFields(apf::Mesh2*& m) {
-    if (m->findField("pressure")) // assume we had solution before
-      chef::combineField(m,"solution","pressure","velocity","temperature");
-    if (m->findField("der_pressure")) // assume we had time derivative of solution before
-      chef::combineField(m,"time derivative of solution","der_pressure","der_velocity","der_temperature");
-    if (m->findField("mesh_vel_sim"))
-      convertField(m, "mesh_vel_sim", "mesh_vel");
-    if (m->findField("ctcn_elm_sim"))
-      convertVtxFieldToElm(m, "ctcn_elm_sim", "err_tri_f");
+    for (int i = 0; i < numOfRegisteredFields; i++) {
+      MappedField const& f = mappedFields[i];
+      if (!m->findField(f.parts[0].name)) // assume we had this field before
+        continue;
+      if (f.onElements)
+        convertVtxFieldToElm(m, f.parts[0].name, f.outName);
+      else
+        combineFields(m, f.outName, f.parts, f.numParts);
+    }
     // destroy mesh size field
     if(m->findField("sizes"))  apf::destroyField(m->findField("sizes"));
     if(m->findField("frames")) apf::destroyField(m->findField("frames"));
@@ -278,12 +344,14 @@ namespace pc {
     GFIter_delete(gfIter);
   }
 
-  double estimateAdaptedMeshElements(apf::Mesh2*& m, apf::Field* sizes) {
+  void estimateAdaptedElementCounts(apf::Mesh2*& m, apf::Field* sizes,
+                                    std::vector<double>& counts) {
     attachCurrentSizeField(m);
     apf::Field* cur_size = m->findField("cur_size");
     assert(cur_size);
 
-    double estElm = 0.0;
+    counts.clear();
+    counts.reserve(m->count(m->getDimension()));
     apf::Vector3 v_mag  = apf::Vector3(0.0, 0.0, 0.0);
     int num_dims = m->getDimension();
     assert(num_dims == 3); // only work for 3D mesh
@@ -294,18 +362,27 @@ namespace pc {
       apf::MeshElement* elm = apf::createMeshElement(m,en);
       apf::Element* fd_elm = apf::createElement(sizes,elm);
       apf::getVector(fd_elm,xi,v_mag);
+      apf::destroyElement(fd_elm);
+      apf::destroyMeshElement(elm);
       double h_old = apf::getScalar(cur_size,en,0);
       if(EN_isBLEntity(reinterpret_cast<pEntity>(en))) {
-        estElm = estElm + (h_old/v_mag[0])*(h_old/v_mag[0]);
+        counts.push_back((h_old/v_mag[0])*(h_old/v_mag[0]));
       }
       else {
-        estElm = estElm + (h_old/v_mag[0])*(h_old/v_mag[0])*(h_old/v_mag[0]);
+        counts.push_back((h_old/v_mag[0])*(h_old/v_mag[0])*(h_old/v_mag[0]));
       }
     }
     m->end(eit);
 
     apf::destroyField(cur_size);
+  }
 
+  double estimateAdaptedMeshElements(apf::Mesh2*& m, apf::Field* sizes) {
+    std::vector<double> counts;
+    estimateAdaptedElementCounts(m, sizes, counts);
+    double estElm = 0.0;
+    for (size_t i = 0; i < counts.size(); i++)
+      estElm = estElm + counts[i];
     double estTolElm = PCU_Add_Double(estElm);
     return estTolElm;
   }
@@ -443,13 +520,7 @@ namespace pc {
       VolumeMeshImprover_setMapFields(vmi, sim_fld_lst);
   }
 
-  void setupSimAdapter(pMSAdapt adapter, ph::Input& in, apf::Mesh2*& m, pPList& sim_fld_lst) {
-    MSA_setAdaptBL(adapter, 1);
-    MSA_setExposedBLBehavior(adapter,BL_DisallowExposed);
-    MSA_setBLSnapping(adapter, 0); // currently needed for parametric model
-    MSA_setBLMinLayerAspectRatio(adapter, 0.0); // needed in parallel
-    MSA_setSizeGradation(adapter, 1, 0.0);
-
+  pPList prepareSimAdapt(ph::Input& in, apf::Mesh2*& m) {
     /* attach mesh size field */
     phSolver::Input inp("solver.inp", "input.config");
     attachMeshSizeField(m, in, inp);
@@ -472,11 +543,34 @@ namespace pc {
     pc::applyMaxSizeBound(m, sizes, in);
 
     /* add mesh smooth/gradation function here */
-    pc::addSmoother(m, in.gradingFactor);
+    bool asyncGrading =
+      pc::getOptionalString(inp, "Mesh Gradation Mode", "Bulk Synchronous") == "Asynchronous";
+    int gradingThreads = pc::getOptionalInt(inp, "Mesh Gradation Threads", 1);
+    pc::addSmoother(m, in.gradingFactor, asyncGrading, gradingThreads);
 
     /* sync mesh size over partitions */
 //    pc::syncMeshSize(m, sizes);
 
+    /* write error and mesh size */
+    pc::writeSequence(m, in.timeStepNumber, "error_mesh_size_");
+
+    /* split the fields to be mapped into SIM fields now, so that they
+       migrate with the mesh if it is rebalanced before adaptation */
+    if (in.solutionMigration)
+      return getSimFieldList(in, m, sizes);
+    return PList_new();
+  }
+
+  void configureSimAdapter(pMSAdapt adapter, ph::Input& in, apf::Mesh2*& m, pPList sim_fld_lst) {
+    MSA_setAdaptBL(adapter, 1);
+    MSA_setExposedBLBehavior(adapter,BL_DisallowExposed);
+    MSA_setBLSnapping(adapter, 0); // currently needed for parametric model
+    MSA_setBLMinLayerAspectRatio(adapter, 0.0); // needed in parallel
+    MSA_setSizeGradation(adapter, 1, 0.0);
+
+    apf::Field* sizes = m->findField("sizes");
+    assert(sizes);
+
     /* use current size field */
     if(!PCU_Comm_Self())
       printf("Start mesh adapt of setting size field\n");
@@ -490,16 +584,18 @@ namespace pc {
       MSA_setVertexSize(adapter, meshVertex, v_mag[0]);
     }
     m->end(vit);
-
-    /* write error and mesh size */
-    pc::writeSequence(m, in.timeStepNumber, "error_mesh_size_");
+    /* the adapter holds the sizes now */
+    apf::destroyField(sizes);
 
     /* set fields to be mapped */
-    PList_clear(sim_fld_lst);
-    if (in.solutionMigration) {
-      sim_fld_lst = getSimFieldList(in, m);
+    if (in.solutionMigration)
       MSA_setMapFields(adapter, sim_fld_lst);
-    }
+  }
+
+  void setupSimAdapter(pMSAdapt adapter, ph::Input& in, apf::Mesh2*& m, pPList& sim_fld_lst) {
+    PList_delete(sim_fld_lst);
+    sim_fld_lst = prepareSimAdapt(in, m);
+    configureSimAdapter(adapter, in, m, sim_fld_lst);
   }
 
   void runMeshAdapter(ph::Input& in, apf::Mesh2*& m, apf::Field*& orgSF, int step) {
@@ -526,9 +622,11 @@ namespace pc {
       /* create the Simmetrix adapter */
       if(!PCU_Comm_Self())
         printf("Start mesh adapt\n");
+      pPList sim_fld_lst = prepareSimAdapt(in, m);
+      /* spread the predicted adapted mesh evenly before refining */
+      pc::balanceForAdapt(m, m->findField("sizes"), progress);
       pMSAdapt adapter = MSA_new(sim_pm, 1);
-      pPList sim_fld_lst = PList_new();
-      setupSimAdapter(adapter, in, m, sim_fld_lst);
+      configureSimAdapter(adapter, in, m, sim_fld_lst);
 
       /* run the adapter */
       if(!PCU_Comm_Self())
@@ -548,7 +646,7 @@ namespace pc {
       PList_delete(sim_fld_lst);
 
       /* load balance */
-      pc::balanceEqualWeights(sim_pm, progress);
+      pc::balanceMesh(m, progress);
 
       /* write mesh */
       if(!PCU_Comm_Self())
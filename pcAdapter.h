@@ -10,18 +10,20 @@
 #include <chef.h>
 #include <phasta.h>
 #include <MeshSimAdapt.h>
+#include <vector>
 
 namespace pc {
 
   void attachMeshSizeField(apf::Mesh2*& m, ph::Input& in, phSolver::Input& inp);
 
-  int getNumOfMappedFields(apf::Mesh2*& m);
+  /* number of SIM fields the registered fields present on m split into */
+  int getNumOfMappedFields(apf::Mesh2*& m, phSolver::Input& inp);
 
-  void removeOtherFields(apf::Mesh2*& m, phSolver::Input& inp);
+  void removeOtherFields(apf::Mesh2*& m, phSolver::Input& inp, apf::Field* keep = 0);
 
   int getSimFields(apf::Mesh2*& m, int simFlag, pField* sim_flds, phSolver::Input& inp);
 
-  pPList getSimFieldList(ph::Input& in, apf::Mesh2*& m);
+  pPList getSimFieldList(ph::Input& in, apf::Mesh2*& m, apf::Field* keep = 0);
 
   void attachMinSizeFlagField(apf::Mesh2*& m, ph::Input& in);
 
@@ -31,6 +33,19 @@ namespace pc {
 
   void setupSimImprover(pVolumeMeshImprover vmi, pPList sim_fld_lst);
 
+  /* predicted number of elements each element of m adapts into */
+  void estimateAdaptedElementCounts(apf::Mesh2*& m, apf::Field* sizes,
+                                    std::vector<double>& counts);
+
+  /* size field for the adapter, with bounds and gradation applied, and
+     the SIM fields to be mapped (an empty list without solution
+     migration); both migrate with the mesh */
+  pPList prepareSimAdapt(ph::Input& in, apf::Mesh2*& m);
+
+  /* adapter options, vertex sizes from prepareSimAdapt (the size field is
+     destroyed afterwards) and the fields to be mapped */
+  void configureSimAdapter(pMSAdapt adapter, ph::Input& in, apf::Mesh2*& m, pPList sim_fld_lst);
+
   void setupSimAdapter(pMSAdapt adapter, ph::Input& in, apf::Mesh2*& m, pPList& sim_fld_lst);
 
   void runMeshAdapter(ph::Input& in, apf::Mesh2*& m, apf::Field*& orgSF, int step);
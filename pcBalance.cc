@@ -0,0 +1,421 @@
+#include "pcBalance.h"
+#include "pcUpdateMesh.h"
+#include "pcInput.h"
+#include "pcAdapter.h"
+#include <SimMeshTools.h>
+#include <MeshSim.h>
+#include <PCU.h>
+#include <apfNumbering.h>
+#include <apfShape.h>
+#include <cassert>
+#include <cstdio>
+#include <algorithm>
+#include <map>
+
+namespace pc {
+
+  void getElementCosts(apf::Mesh* m, phSolver::Input& inp, std::vector<double>& costs) {
+    int order = getOptionalInt(inp, "Quadrature Rule on Interior", 2);
+    double blWeight = getOptionalDouble(inp, "BL Element Cost Factor", 1.0);
+    double ctcnWeight = getOptionalDouble(inp, "Time Resource Cost Factor", 0.0);
+    apf::Field* ctcn = m->findField("ctcn_elm");
+    if (!ctcn)
+      ctcn = m->findField("ctcn_elm_sim");
+    bool isSim = dynamic_cast<apf::MeshSIM*>(m) != 0;
+    std::vector<int> pointsOfType(apf::Mesh::TYPES, -1);
+    costs.clear();
+    costs.reserve(m->count(3));
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(3);
+    while ((e = m->iterate(it))) {
+      int type = m->getType(e);
+      if (pointsOfType[type] < 0) {
+        apf::MeshElement* me = apf::createMeshElement(m, e);
+        pointsOfType[type] = apf::countIntPoints(me, order);
+        apf::destroyMeshElement(me);
+      }
+      double cost = pointsOfType[type];
+      if (isSim && EN_isBLEntity(reinterpret_cast<pEntity>(e)))
+        cost *= blWeight;
+      if (ctcn && ctcnWeight != 0.0) {
+        apf::Downward verts;
+        int nv = m->getDownward(e, 0, verts);
+        double f = 0.0;
+        for (int i = 0; i < nv; i++)
+          f += apf::getScalar(ctcn, verts[i], 0) / nv;
+        cost *= std::max(1.0 + ctcnWeight * (f - 1.0), 0.1);
+      }
+      costs.push_back(cost);
+    }
+    m->end(it);
+  }
+
+  double getImbalance(std::vector<double> const& weights) {
+    double w = 0.0;
+    for (size_t i = 0; i < weights.size(); i++)
+      w += weights[i];
+    double total = PCU_Add_Double(w);
+    if (total <= 0.0)
+      return 1.0;
+    return PCU_Max_Double(w) / (total / PCU_Comm_Peers());
+  }
+
+  static int findStack(std::vector<int>& stack, int k) {
+    while (stack[k] != k)
+      k = stack[k] = stack[stack[k]];
+    return k;
+  }
+
+  /* boundary layer prisms are joined into stacks through their triangle
+     faces, and every element of a stack takes the centroid of its base,
+     the prism on the model boundary, so bisection never splits a stack.
+     stacks are assumed whole on one part, as Simmetrix partitions them
+     and as our own migrations keep them */
+  static void centerBLStacks(apf::Mesh* m, std::vector<double>& x) {
+    if (!dynamic_cast<apf::MeshSIM*>(m))
+      return;
+    apf::Numbering* nums = apf::createNumbering(m, "balance_stack",
+        apf::getConstant(3), 1);
+    std::vector<char> isBL;
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(3);
+    int n = 0;
+    while ((e = m->iterate(it))) {
+      apf::number(nums, e, 0, 0, n++);
+      isBL.push_back(EN_isBLEntity(reinterpret_cast<pEntity>(e)));
+    }
+    m->end(it);
+    std::vector<int> stack(n);
+    std::vector<int> base(n, -1);
+    for (int k = 0; k < n; k++)
+      stack[k] = k;
+    it = m->begin(2);
+    while ((e = m->iterate(it))) {
+      if (m->getType(e) != apf::Mesh::TRIANGLE)
+        continue;
+      apf::Up up;
+      m->getUp(e, up);
+      int k[2];
+      bool prism = false;
+      for (int i = 0; i < up.n; i++) {
+        k[i] = apf::getNumber(nums, up.e[i], 0, 0);
+        prism = prism || m->getType(up.e[i]) == apf::Mesh::PRISM;
+      }
+      if (!prism)
+        continue;
+      if (up.n == 1 && isBL[k[0]] && m->getModelType(m->toModel(e)) == 2)
+        base[k[0]] = k[0];
+      else if (up.n == 2 && isBL[k[0]] && isBL[k[1]])
+        stack[findStack(stack, k[0])] = findStack(stack, k[1]);
+    }
+    m->end(it);
+    apf::destroyNumbering(nums);
+    // the base of each stack, or its root when the base is not local
+    std::vector<int> baseOf(n, -1);
+    for (int k = 0; k < n; k++)
+      if (base[k] >= 0)
+        baseOf[findStack(stack, k)] = k;
+    for (int k = 0; k < n; k++) {
+      if (!isBL[k])
+        continue;
+      int r = findStack(stack, k);
+      int b = baseOf[r] >= 0 ? baseOf[r] : r;
+      for (int d = 0; d < 3; d++)
+        x[3 * k + d] = x[3 * b + d];
+    }
+  }
+
+  /* every level splits each group of parts [lo,hi) in two along the
+     longest axis of its box; the cut is found by bisection on the
+     weight below it, with all groups of a level sharing the collectives */
+  void partitionRCB(apf::Mesh* m, std::vector<double> const& weights,
+                    std::vector<int>& dest) {
+    int n = weights.size();
+    std::vector<double> x(3 * n);
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(3);
+    int i = 0;
+    while ((e = m->iterate(it))) {
+      apf::Vector3 c = apf::getLinearCentroid(m, e);
+      c.toArray(&x[3 * i]);
+      ++i;
+    }
+    m->end(it);
+    assert(i == n);
+    centerBLStacks(m, x);
+
+    int peers = PCU_Comm_Peers();
+    std::vector<int> lo(n, 0);
+    // groups of more than one part still to split, keyed by their lo
+    std::vector<int> groupLo(1, 0);
+    std::vector<int> groupHi(1, peers);
+    std::vector<int> groupOf(peers);
+    while (peers > 1 && !groupLo.empty()) {
+      int ng = groupLo.size();
+      std::fill(groupOf.begin(), groupOf.end(), -1);
+      for (int g = 0; g < ng; g++)
+        groupOf[groupLo[g]] = g;
+      // boxes, with the maxima negated so one min reduction does both
+      std::vector<double> box(6 * ng, 1e300);
+      std::vector<double> total(ng, 0.0);
+      for (int k = 0; k < n; k++) {
+        int g = groupOf[lo[k]];
+        if (g < 0)
+          continue;
+        for (int d = 0; d < 3; d++) {
+          box[6 * g + d] = std::min(box[6 * g + d], x[3 * k + d]);
+          box[6 * g + 3 + d] = std::min(box[6 * g + 3 + d], -x[3 * k + d]);
+        }
+        total[g] += weights[k];
+      }
+      PCU_Min_Doubles(&box[0], box.size());
+      PCU_Add_Doubles(&total[0], total.size());
+      std::vector<int> axis(ng, 0);
+      std::vector<int> mid(ng);
+      std::vector<double> cutLo(ng), cutHi(ng), cut(ng), target(ng);
+      for (int g = 0; g < ng; g++) {
+        double ext = -1.0;
+        for (int d = 0; d < 3; d++) {
+          double l = -box[6 * g + 3 + d] - box[6 * g + d];
+          if (l > ext) {
+            ext = l;
+            axis[g] = d;
+          }
+        }
+        cutLo[g] = box[6 * g + axis[g]];
+        cutHi[g] = -box[6 * g + 3 + axis[g]];
+        mid[g] = (groupLo[g] + groupHi[g]) / 2;
+        target[g] = total[g] * (mid[g] - groupLo[g]) / (groupHi[g] - groupLo[g]);
+      }
+      for (int iter = 0; iter < 50; iter++) {
+        std::vector<double> below(ng, 0.0);
+        for (int g = 0; g < ng; g++)
+          cut[g] = 0.5 * (cutLo[g] + cutHi[g]);
+        for (int k = 0; k < n; k++) {
+          int g = groupOf[lo[k]];
+          if (g >= 0 && x[3 * k + axis[g]] < cut[g])
+            below[g] += weights[k];
+        }
+        PCU_Add_Doubles(&below[0], below.size());
+        for (int g = 0; g < ng; g++) {
+          if (below[g] < target[g])
+            cutLo[g] = cut[g];
+          else
+            cutHi[g] = cut[g];
+        }
+      }
+      for (int k = 0; k < n; k++) {
+        int g = groupOf[lo[k]];
+        if (g < 0)
+          continue;
+        if (x[3 * k + axis[g]] >= cut[g])
+          lo[k] = mid[g];
+      }
+      std::vector<int> nextLo, nextHi;
+      for (int g = 0; g < ng; g++) {
+        if (mid[g] - groupLo[g] > 1) {
+          nextLo.push_back(groupLo[g]);
+          nextHi.push_back(mid[g]);
+        }
+        if (groupHi[g] - mid[g] > 1) {
+          nextLo.push_back(mid[g]);
+          nextHi.push_back(groupHi[g]);
+        }
+      }
+      groupLo.swap(nextLo);
+      groupHi.swap(nextHi);
+    }
+    dest = lo;
+  }
+
+  void migrateElements(apf::Mesh2* m, std::vector<int> const& dest, pProgress progress) {
+    apf::MeshSIM* sim_m = dynamic_cast<apf::MeshSIM*>(m);
+    assert(sim_m);
+    pParMesh ppm = sim_m->getMesh();
+    int self = PMU_rank();
+    long moved = 0;
+    pMigrator migr = Migrator_new(ppm, 3);
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(3);
+    int i = 0;
+    while ((e = m->iterate(it))) {
+      if (dest[i] != self) {
+        Migrator_add(migr, reinterpret_cast<pEntity>(e), PMU_gid(dest[i], 0), PMU_gid(self, 0));
+        ++moved;
+      }
+      ++i;
+    }
+    m->end(it);
+    Migrator_run(migr, progress);
+    Migrator_delete(migr);
+    moved = PCU_Add_Long(moved);
+    if(!PCU_Comm_Self())
+      printf("migrated %ld elements\n", moved);
+  }
+
+  /* solver costs when weighted, otherwise one per element */
+  static void getBalanceWeights(apf::Mesh* m, phSolver::Input& inp, bool weighted,
+                                std::vector<double>& weights) {
+    if (weighted) {
+      getElementCosts(m, inp, weights);
+      return;
+    }
+    weights.assign(m->count(3), 1.0);
+  }
+
+  /* one diffusion step: each part hands a share of its surplus over every
+     lighter neighbor part as a layer of the elements on their shared
+     faces. the share (w_p - w_q) / (max degree + 1) keeps the iteration
+     from oscillating. boundary layer elements stay put so their stacks
+     are not split. nums gets the element order of the weights. returns
+     the number of elements given away */
+  static long diffuseStep(apf::Mesh2* m, apf::Numbering* nums,
+                          std::vector<double> const& weights,
+                          std::vector<int>& dest) {
+    int self = PCU_Comm_Self();
+    bool isSim = dynamic_cast<apf::MeshSIM*>(m) != 0;
+    double w = 0.0;
+    int n = 0;
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(3);
+    while ((e = m->iterate(it))) {
+      apf::number(nums, e, 0, 0, n);
+      w += weights[n++];
+    }
+    m->end(it);
+    dest.assign(n, self);
+
+    // elements on the faces shared with each neighbor part
+    std::map<int, std::vector<apf::MeshEntity*> > boundary;
+    apf::Copies remotes;
+    it = m->begin(2);
+    while ((e = m->iterate(it))) {
+      if (!m->isShared(e))
+        continue;
+      m->getRemotes(e, remotes);
+      apf::Up up;
+      m->getUp(e, up);
+      for (int i = 0; i < up.n; i++)
+        APF_ITERATE(apf::Copies, remotes, rit)
+          boundary[rit->first].push_back(up.e[i]);
+    }
+    m->end(it);
+
+    int degree = boundary.size();
+    PCU_Comm_Begin();
+    APF_ITERATE(std::map<int, std::vector<apf::MeshEntity*> >, boundary, bit) {
+      PCU_COMM_PACK(bit->first, w);
+      PCU_COMM_PACK(bit->first, degree);
+    }
+    PCU_Comm_Send();
+    std::map<int, double> flux;
+    while (PCU_Comm_Receive()) {
+      double wq;
+      int degq;
+      PCU_COMM_UNPACK(wq);
+      PCU_COMM_UNPACK(degq);
+      if (wq < w)
+        flux[PCU_Comm_Sender()] = (w - wq) / (std::max(degree, degq) + 1);
+    }
+
+    long moved = 0;
+    APF_ITERATE(std::map<int, double>, flux, fit) {
+      std::vector<apf::MeshEntity*> const& elms = boundary[fit->first];
+      double sent = 0.0;
+      for (size_t i = 0; i < elms.size() && sent < fit->second; i++) {
+        int k = apf::getNumber(nums, elms[i], 0, 0);
+        if (dest[k] != self)
+          continue;
+        if (isSim && EN_isBLEntity(reinterpret_cast<pEntity>(elms[i])))
+          continue;
+        dest[k] = fit->first;
+        sent += weights[k];
+        ++moved;
+      }
+    }
+    return moved;
+  }
+
+  bool diffuseBalance(apf::Mesh2* m, phSolver::Input& inp, bool weighted,
+                      double tolerance, pProgress progress) {
+    int maxSteps = getOptionalInt(inp, "Diffusive Balancing Steps", 10);
+    std::vector<double> weights;
+    std::vector<int> dest;
+    getBalanceWeights(m, inp, weighted, weights);
+    double imb = getImbalance(weights);
+    // renumbered in place every step, as migration changes the elements
+    apf::Numbering* nums = apf::createNumbering(m, "balance_elm",
+        apf::getConstant(3), 1);
+    for (int step = 0; step < maxSteps && imb > tolerance; step++) {
+      long moved = PCU_Add_Long(diffuseStep(m, nums, weights, dest));
+      if (!moved)
+        break;
+      migrateElements(m, dest, progress);
+      getBalanceWeights(m, inp, weighted, weights);
+      double next = getImbalance(weights);
+      if(!PCU_Comm_Self())
+        printf("diffusive balancing step %d: imbalance %f\n", step, next);
+      bool stalled = next >= imb;
+      imb = next;
+      if (stalled)
+        break;
+    }
+    apf::destroyNumbering(nums);
+    return imb <= tolerance;
+  }
+
+  void balanceMesh(apf::Mesh2* m, pProgress progress) {
+    apf::MeshSIM* sim_m = dynamic_cast<apf::MeshSIM*>(m);
+    assert(sim_m);
+    phSolver::Input inp("solver.inp", "input.config");
+    bool weighted = getOptionalInt(inp, "Weighted Partitioning", 0);
+    double diffusiveLimit = getOptionalDouble(inp, "Diffusive Balancing Limit", 0.0);
+    bool diffusive = diffusiveLimit > 1.0;
+    if (!weighted && !diffusive) {
+      balanceEqualWeights(sim_m->getMesh(), progress);
+      return;
+    }
+    double tolerance = getOptionalDouble(inp, "Partition Imbalance Tolerance", 1.05);
+    std::vector<double> costs;
+    getBalanceWeights(m, inp, weighted, costs);
+    double imb = getImbalance(costs);
+    if(!PCU_Comm_Self())
+      printf("%s imbalance %f (tolerance %f)\n",
+             weighted ? "solver cost" : "element", imb, tolerance);
+    if (imb <= tolerance)
+      return;
+    if (diffusive && imb < diffusiveLimit &&
+        diffuseBalance(m, inp, weighted, tolerance, progress))
+      return;
+    if (!weighted) {
+      balanceEqualWeights(sim_m->getMesh(), progress);
+      return;
+    }
+    getElementCosts(m, inp, costs);
+    std::vector<int> dest;
+    partitionRCB(m, costs, dest);
+    migrateElements(m, dest, progress);
+    getElementCosts(m, inp, costs);
+    imb = getImbalance(costs);
+    if(!PCU_Comm_Self())
+      printf("solver cost imbalance after weighted partitioning %f\n", imb);
+  }
+
+  void balanceForAdapt(apf::Mesh2* m, apf::Field* sizes, pProgress progress) {
+    phSolver::Input inp("solver.inp", "input.config");
+    if (!getOptionalInt(inp, "Predictive Adapt Balancing", 0))
+      return;
+    double tolerance = getOptionalDouble(inp, "Partition Imbalance Tolerance", 1.05);
+    std::vector<double> counts;
+    estimateAdaptedElementCounts(m, sizes, counts);
+    double imb = getImbalance(counts);
+    if(!PCU_Comm_Self())
+      printf("predicted adapted mesh imbalance %f (tolerance %f)\n", imb, tolerance);
+    if (imb <= tolerance)
+      return;
+    std::vector<int> dest;
+    partitionRCB(m, counts, dest);
+    migrateElements(m, dest, progress);
+  }
+
+}
@@ -0,0 +1,53 @@
+#ifndef PC_BALANCE_H
+#define PC_BALANCE_H
+
+#include <apf.h>
+#include <apfMesh2.h>
+#include <apfSIM.h>
+#include <phasta.h>
+#include <SimPartitionedMesh.h>
+#include <vector>
+
+namespace pc {
+
+  /* solver cost of each element in m->begin(3) order: integration points
+     of its type at the interior quadrature rule, scaled for boundary
+     layer elements and the time resource factor ctcn_elm */
+  void getElementCosts(apf::Mesh* m, phSolver::Input& inp, std::vector<double>& costs);
+
+  /* heaviest part weight over the average part weight */
+  double getImbalance(std::vector<double> const& weights);
+
+  /* weighted recursive coordinate bisection of the element centroids into
+     PCU_Comm_Peers() parts; dest[i] gets the part of the i-th element.
+     boundary layer prism stacks go to one part whole */
+  void partitionRCB(apf::Mesh* m, std::vector<double> const& weights,
+                    std::vector<int>& dest);
+
+  /* move the regions of a Simmetrix mesh to their dest parts */
+  void migrateElements(apf::Mesh2* m, std::vector<int> const& dest, pProgress progress);
+
+  /* migrate boundary elements between neighbor parts, at most
+     "Diffusive Balancing Steps" times, until the imbalance of the solver
+     costs (weighted) or element counts is within tolerance. returns
+     false when diffusion stalls short of it */
+  bool diffuseBalance(apf::Mesh2* m, phSolver::Input& inp, bool weighted,
+                      double tolerance, pProgress progress);
+
+  /* balance solver costs when "Weighted Partitioning" is on, else element
+     counts. an imbalance within "Partition Imbalance Tolerance" is left
+     alone, one below "Diffusive Balancing Limit" is first diffused, and
+     anything else is repartitioned: by RCB on the costs, or with
+     balanceEqualWeights. with neither option set every call repartitions
+     with balanceEqualWeights */
+  void balanceMesh(apf::Mesh2* m, pProgress progress);
+
+  /* with "Predictive Adapt Balancing" on, repartition before adaptation
+     by the element counts the size field predicts, so every part refines
+     to about the same size. partitionRCB keeps boundary layer stacks
+     whole, as MSA_adapt with MSA_setAdaptBL needs them */
+  void balanceForAdapt(apf::Mesh2* m, apf::Field* sizes, pProgress progress);
+
+}
+
+#endif
@@ -0,0 +1,34 @@
+#include "pcInput.h"
+
+namespace pc {
+
+  std::string getOptionalString(phSolver::Input& inp, const char* key,
+                                const char* defaultValue) {
+    std::string value(defaultValue);
+    try {
+      value = (std::string)inp.GetValue(key);
+    }
+    catch(...){}
+    return value;
+  }
+
+  int getOptionalInt(phSolver::Input& inp, const char* key, int defaultValue) {
+    int value = defaultValue;
+    try {
+      value = (int)inp.GetValue(key);
+    }
+    catch(...){}
+    return value;
+  }
+
+  double getOptionalDouble(phSolver::Input& inp, const char* key,
+                           double defaultValue) {
+    double value = defaultValue;
+    try {
+      value = (double)inp.GetValue(key);
+    }
+    catch(...){}
+    return value;
+  }
+
+}
@@ -0,0 +1,21 @@
+#ifndef PC_INPUT_H
+#define PC_INPUT_H
+
+#include <phasta.h>
+#include <string>
+
+namespace pc {
+
+  /* optional keys in solver.inp; the default is returned
+     when the key is not known to input.config */
+  std::string getOptionalString(phSolver::Input& inp, const char* key,
+                                const char* defaultValue);
+
+  int getOptionalInt(phSolver::Input& inp, const char* key, int defaultValue);
+
+  double getOptionalDouble(phSolver::Input& inp, const char* key,
+                           double defaultValue);
+
+}
+
+#endif
@@ -0,0 +1,461 @@
+#include "pcPointLocator.h"
+#include <apfMesh.h>
+#include <apfMatrix.h>
+#include <apfShape.h>
+#include <PCU.h>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <sstream>
+
+namespace {
+
+  const int leafSize = 8;
+  const int cacheMagic = 0x62766831;
+
+  struct CentroidLess {
+    const std::vector<double>* elmBoxes;
+    int axis;
+    bool operator()(int a, int b) const {
+      const std::vector<double>& bx = *elmBoxes;
+      return bx[6*a+axis] + bx[6*a+axis+3] < bx[6*b+axis] + bx[6*b+axis+3];
+    }
+  };
+
+  void elementBox(apf::Mesh* m, apf::MeshEntity* e, double* box) {
+    apf::Downward verts;
+    int nv = m->getDownward(e, 0, verts);
+    for (int i = 0; i < 3; i++) {
+      box[i] = 1e300;
+      box[i+3] = -1e300;
+    }
+    apf::Vector3 p;
+    for (int j = 0; j < nv; j++) {
+      m->getPoint(verts[j], 0, p);
+      for (int i = 0; i < 3; i++) {
+        box[i]   = std::min(box[i], p[i]);
+        box[i+3] = std::max(box[i+3], p[i]);
+      }
+    }
+  }
+
+  double boxDistance(const double* box, apf::Vector3 const& x) {
+    double d2 = 0.0;
+    for (int i = 0; i < 3; i++) {
+      double d = 0.0;
+      if (x[i] < box[i])
+        d = box[i] - x[i];
+      else if (x[i] > box[i+3])
+        d = x[i] - box[i+3];
+      d2 += d*d;
+    }
+    return sqrt(d2);
+  }
+
+  /* nodes are stored depth first: the left child follows its parent */
+  void buildNode(pc::PointLocator* pl, int begin, int end) {
+    int node = pl->first.size();
+    pl->first.push_back(-1);
+    pl->count.push_back(0);
+    double box[6] = {1e300, 1e300, 1e300, -1e300, -1e300, -1e300};
+    for (int k = begin; k < end; k++) {
+      const double* eb = &pl->elmBoxes[6*pl->order[k]];
+      for (int i = 0; i < 3; i++) {
+        box[i]   = std::min(box[i], eb[i]);
+        box[i+3] = std::max(box[i+3], eb[i+3]);
+      }
+    }
+    pl->boxes.insert(pl->boxes.end(), box, box + 6);
+    if (end - begin <= leafSize) {
+      pl->first[node] = begin;
+      pl->count[node] = end - begin;
+      return;
+    }
+    int axis = 0;
+    for (int i = 1; i < 3; i++)
+      if (box[i+3] - box[i] > box[axis+3] - box[axis])
+        axis = i;
+    CentroidLess less;
+    less.elmBoxes = &pl->elmBoxes;
+    less.axis = axis;
+    int mid = (begin + end) / 2;
+    std::nth_element(pl->order.begin() + begin, pl->order.begin() + mid,
+                     pl->order.begin() + end, less);
+    buildNode(pl, begin, mid);
+    pl->count[node] = pl->first.size();
+    buildNode(pl, mid, end);
+  }
+
+  void parentCenter(int type, apf::Vector3& xi) {
+    if (type == apf::Mesh::TET)
+      xi = apf::Vector3(0.25, 0.25, 0.25);
+    else if (type == apf::Mesh::TRIANGLE || type == apf::Mesh::PRISM)
+      xi = apf::Vector3(1.0/3.0, 1.0/3.0, 0.0);
+    else if (type == apf::Mesh::PYRAMID)
+      xi = apf::Vector3(0.0, 0.0, -0.5);
+    else
+      xi = apf::Vector3(0.0, 0.0, 0.0);
+  }
+
+  void clampSimplex(double* xi, int n) {
+    double sum = 0.0;
+    for (int i = 0; i < n; i++) {
+      xi[i] = std::max(xi[i], 0.0);
+      sum += xi[i];
+    }
+    if (sum > 1.0)
+      for (int i = 0; i < n; i++)
+        xi[i] /= sum;
+  }
+
+  void clampCube(double* xi, int n) {
+    for (int i = 0; i < n; i++)
+      xi[i] = std::min(std::max(xi[i], -1.0), 1.0);
+  }
+
+  /* pull parent coordinates back onto the parent element */
+  void clampToParent(int type, apf::Vector3& xi) {
+    if (type == apf::Mesh::TET)
+      clampSimplex(&xi[0], 3);
+    else if (type == apf::Mesh::TRIANGLE)
+      clampSimplex(&xi[0], 2);
+    else if (type == apf::Mesh::PRISM) {
+      clampSimplex(&xi[0], 2);
+      clampCube(&xi[2], 1);
+    }
+    else if (type == apf::Mesh::QUAD)
+      clampCube(&xi[0], 2);
+    else
+      clampCube(&xi[0], 3);
+  }
+
+  /* invert the element map by Newton iteration (exact in one step for
+     linear simplices); xi may land outside the parent element */
+  void invertElement(apf::MeshElement* me, int type,
+                     apf::Vector3 const& x, apf::Vector3& xi) {
+    int dim = apf::Mesh::typeDimension[type];
+    parentCenter(type, xi);
+    apf::Vector3 y;
+    apf::Matrix3x3 J;
+    for (int it = 0; it < 10; it++) {
+      apf::mapLocalToGlobal(me, xi, y);
+      apf::Vector3 r = x - y;
+      apf::getJacobian(me, xi, J);
+      J = apf::transpose(J);
+      if (dim == 2)
+        J[2][2] = 1.0;
+      apf::Vector3 dxi = apf::invert(J) * r;
+      xi = xi + dxi;
+      if (dxi.getLength() < 1e-12)
+        break;
+    }
+  }
+
+  /* straight-sided tets are inverted from their vertex coordinates
+     without building an apf::MeshElement */
+  bool isLinearTet(apf::Mesh* m, apf::MeshEntity* e) {
+    return m->getType(e) == apf::Mesh::TET && m->getShape()->getOrder() == 1;
+  }
+
+  void invertLinearTet(apf::Mesh* m, apf::MeshEntity* e, apf::Vector3 const& x,
+                       apf::Vector3& xi, apf::Vector3& origin,
+                       apf::Matrix3x3& J) {
+    apf::Downward verts;
+    m->getDownward(e, 0, verts);
+    apf::Vector3 p[4];
+    for (int i = 0; i < 4; i++)
+      m->getPoint(verts[i], 0, p[i]);
+    origin = p[0];
+    J = apf::transpose(apf::Matrix3x3(p[1] - p[0], p[2] - p[0], p[3] - p[0]));
+    xi = apf::invert(J) * (x - origin);
+  }
+
+  /* distance from x to the element, zero when x is inside */
+  double elementDistance(apf::Mesh* m, apf::MeshEntity* e,
+                         apf::Vector3 const& x, apf::Vector3& xi) {
+    int type = m->getType(e);
+    if (isLinearTet(m, e)) {
+      apf::Vector3 origin;
+      apf::Matrix3x3 J;
+      invertLinearTet(m, e, x, xi, origin, J);
+      apf::Vector3 inside = xi;
+      clampToParent(type, xi);
+      if ((xi - inside).getLength() > 0.0)
+        return (x - (origin + J * xi)).getLength();
+      return 0.0;
+    }
+    apf::MeshElement* me = apf::createMeshElement(m, e);
+    apf::Vector3 y;
+    invertElement(me, type, x, xi);
+    apf::Vector3 inside = xi;
+    clampToParent(type, xi);
+    double d = 0.0;
+    if ((xi - inside).getLength() > 0.0) {
+      apf::mapLocalToGlobal(me, xi, y);
+      d = (x - y).getLength();
+    }
+    apf::destroyMeshElement(me);
+    return d;
+  }
+
+  /* walk from tet to tet across the face opposite the most negative
+     barycentric coordinate; gives up on other elements, at the part
+     or model region boundary, or after too many steps */
+  apf::MeshEntity* walkToPoint(apf::Mesh* m, apf::MeshEntity* e,
+                               apf::Vector3 const& x, int tag,
+                               apf::Vector3& xi) {
+    const int maxSteps = 64;
+    apf::MeshEntity* prev = 0;
+    for (int step = 0; step < maxSteps; step++) {
+      if (!isLinearTet(m, e))
+        return 0;
+      apf::Vector3 origin;
+      apf::Matrix3x3 J;
+      invertLinearTet(m, e, x, xi, origin, J);
+      double b[4] = {1.0 - xi[0] - xi[1] - xi[2], xi[0], xi[1], xi[2]};
+      int out = 0;
+      for (int i = 1; i < 4; i++)
+        if (b[i] < b[out])
+          out = i;
+      if (b[out] >= 0.0)
+        return e;
+      apf::Downward verts;
+      apf::Downward faces;
+      m->getDownward(e, 0, verts);
+      int nf = m->getDownward(e, 2, faces);
+      apf::MeshEntity* next = 0;
+      for (int f = 0; f < nf && !next; f++) {
+        apf::Downward fv;
+        int nfv = m->getDownward(faces[f], 0, fv);
+        if (std::find(fv, fv + nfv, verts[out]) != fv + nfv)
+          continue;
+        for (int k = 0; k < m->countUpward(faces[f]); k++) {
+          apf::MeshEntity* up = m->getUpward(faces[f], k);
+          if (up != e)
+            next = up;
+        }
+      }
+      // stop at the boundary and when stepping back and forth
+      if (!next || next == prev ||
+          m->getModelTag(m->toModel(next)) != tag)
+        return 0;
+      prev = e;
+      e = next;
+    }
+    return 0;
+  }
+
+  /* interleave the top 21 bits of each scaled coordinate */
+  unsigned long long mortonCode(const double* box, apf::Vector3 const& x) {
+    unsigned long long code = 0;
+    unsigned int c[3];
+    for (int i = 0; i < 3; i++) {
+      double w = box[i+3] - box[i];
+      double t = w > 0.0 ? (x[i] - box[i]) / w : 0.0;
+      t = std::min(std::max(t, 0.0), 1.0);
+      c[i] = (unsigned int)(t * 2097151.0);
+    }
+    for (int bit = 20; bit >= 0; bit--)
+      for (int i = 0; i < 3; i++)
+        code = (code << 1) | ((c[i] >> bit) & 1u);
+    return code;
+  }
+
+  struct MortonLess {
+    const std::vector<unsigned long long>* codes;
+    bool operator()(int a, int b) const {
+      return (*codes)[a] < (*codes)[b];
+    }
+  };
+
+  std::string cacheName(const char* prefix) {
+    std::stringstream ss;
+    ss << prefix << "_" << PCU_Comm_Self() << ".bvh";
+    return ss.str();
+  }
+
+  double boxChecksum(pc::PointLocator* pl) {
+    double sum = 0.0;
+    for (std::size_t i = 0; i < pl->elmBoxes.size(); i++)
+      sum += pl->elmBoxes[i];
+    return sum;
+  }
+
+  template <class T>
+  bool readArray(FILE* f, std::vector<T>& a, int n) {
+    a.resize(n);
+    return !n || fread(&a[0], sizeof(T), n, f) == (std::size_t)n;
+  }
+
+  template <class T>
+  void writeArray(FILE* f, std::vector<T> const& a) {
+    if (!a.empty())
+      fwrite(&a[0], sizeof(T), a.size(), f);
+  }
+
+  /* the cached tree refers to elements by iteration order, so it is only
+     used when the element count and boxes match the loaded part */
+  bool readCache(pc::PointLocator* pl, const char* prefix) {
+    FILE* f = fopen(cacheName(prefix).c_str(), "rb");
+    if (!f)
+      return false;
+    int header[3];
+    double checksum;
+    bool ok = fread(header, sizeof(int), 3, f) == 3 &&
+              fread(&checksum, sizeof(double), 1, f) == 1 &&
+              header[0] == cacheMagic &&
+              header[1] == (int)pl->elms.size() &&
+              fabs(checksum - boxChecksum(pl)) <= 1e-10 * (fabs(checksum) + 1.0);
+    if (ok) {
+      int numNodes = header[2];
+      ok = readArray(f, pl->order, header[1]) &&
+           readArray(f, pl->first, numNodes) &&
+           readArray(f, pl->count, numNodes) &&
+           readArray(f, pl->boxes, 6*numNodes);
+    }
+    fclose(f);
+    return ok;
+  }
+
+  void writeCache(pc::PointLocator* pl, const char* prefix) {
+    FILE* f = fopen(cacheName(prefix).c_str(), "wb");
+    if (!f)
+      return;
+    int header[3] = {cacheMagic, (int)pl->elms.size(), (int)pl->first.size()};
+    double checksum = boxChecksum(pl);
+    fwrite(header, sizeof(int), 3, f);
+    fwrite(&checksum, sizeof(double), 1, f);
+    writeArray(f, pl->order);
+    writeArray(f, pl->first);
+    writeArray(f, pl->count);
+    writeArray(f, pl->boxes);
+    fclose(f);
+  }
+
+} //end namespace
+
+namespace pc {
+
+  PointLocator* buildPointLocator(apf::Mesh* m, const char* cachePrefix) {
+    PointLocator* pl = new PointLocator();
+    pl->mesh = m;
+    int dim = m->getDimension();
+    pl->elms.reserve(m->count(dim));
+    pl->tags.reserve(m->count(dim));
+    pl->elmBoxes.resize(6*m->count(dim));
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(dim);
+    while ((e = m->iterate(it))) {
+      elementBox(m, e, &pl->elmBoxes[6*pl->elms.size()]);
+      pl->elms.push_back(e);
+      pl->tags.push_back(m->getModelTag(m->toModel(e)));
+    }
+    m->end(it);
+    if (cachePrefix && readCache(pl, cachePrefix))
+      return pl;
+    pl->order.resize(pl->elms.size());
+    for (std::size_t i = 0; i < pl->order.size(); i++)
+      pl->order[i] = i;
+    if (!pl->elms.empty())
+      buildNode(pl, 0, pl->elms.size());
+    if (cachePrefix)
+      writeCache(pl, cachePrefix);
+    return pl;
+  }
+
+  void destroyPointLocator(PointLocator* pl) {
+    delete pl;
+  }
+
+  apf::MeshEntity* locatePoint(PointLocator* pl, apf::Vector3 const& x,
+                               int tag, apf::Vector3& xi, double& dist) {
+    apf::MeshEntity* best = 0;
+    dist = 1e300;
+    if (pl->first.empty())
+      return best;
+    apf::Vector3 exi;
+    // the median split keeps the tree shallow, so a fixed stack is enough
+    // and queries can run concurrently on one locator
+    const int maxStack = 128;
+    int stack[maxStack];
+    int top = 0;
+    stack[top++] = 0;
+    while (top && dist > 0.0) {
+      int node = stack[--top];
+      if (boxDistance(&pl->boxes[6*node], x) >= dist)
+        continue;
+      if (pl->first[node] < 0) {
+        int left = node + 1;
+        int right = pl->count[node];
+        // visit the nearer child first
+        if (boxDistance(&pl->boxes[6*left], x) < boxDistance(&pl->boxes[6*right], x))
+          std::swap(left, right);
+        assert(top + 2 <= maxStack);
+        stack[top++] = left;
+        stack[top++] = right;
+        continue;
+      }
+      for (int k = 0; k < pl->count[node]; k++) {
+        int i = pl->order[pl->first[node] + k];
+        if (tag >= 0 && pl->tags[i] != tag)
+          continue;
+        if (boxDistance(&pl->elmBoxes[6*i], x) >= dist)
+          continue;
+        double d = elementDistance(pl->mesh, pl->elms[i], x, exi);
+        if (d < dist) {
+          dist = d;
+          xi = exi;
+          best = pl->elms[i];
+          if (dist == 0.0)
+            break;
+        }
+      }
+    }
+    return best;
+  }
+
+  apf::MeshEntity* locatePointFrom(PointLocator* pl, apf::Vector3 const& x,
+                                   int tag, apf::MeshEntity* hint,
+                                   apf::Vector3& xi, double& dist) {
+    if (hint && (tag < 0 || pl->mesh->getModelTag(pl->mesh->toModel(hint)) == tag)) {
+      apf::MeshEntity* e = walkToPoint(pl->mesh, hint, x,
+          pl->mesh->getModelTag(pl->mesh->toModel(hint)), xi);
+      if (e) {
+        dist = 0.0;
+        return e;
+      }
+    }
+    return locatePoint(pl, x, tag, xi, dist);
+  }
+
+  void locatePoints(PointLocator* pl, std::vector<apf::Vector3> const& x,
+                    std::vector<int> const& tags,
+                    std::vector<apf::MeshEntity*>& elms,
+                    std::vector<apf::Vector3>& xi,
+                    std::vector<double>& dist) {
+    std::size_t n = x.size();
+    elms.assign(n, 0);
+    xi.resize(n);
+    dist.assign(n, 1e300);
+    if (pl->first.empty())
+      return;
+    std::vector<unsigned long long> codes(n);
+    std::vector<int> sorted(n);
+    for (std::size_t i = 0; i < n; i++) {
+      codes[i] = mortonCode(&pl->boxes[0], x[i]);
+      sorted[i] = i;
+    }
+    MortonLess less;
+    less.codes = &codes;
+    std::sort(sorted.begin(), sorted.end(), less);
+    apf::MeshEntity* hint = 0;
+    for (std::size_t k = 0; k < n; k++) {
+      int i = sorted[k];
+      elms[i] = locatePointFrom(pl, x[i], tags[i], hint, xi[i], dist[i]);
+      if (elms[i])
+        hint = elms[i];
+    }
+  }
+
+}
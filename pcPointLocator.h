@@ -0,0 +1,53 @@
+#ifndef PC_POINT_LOCATOR_H
+#define PC_POINT_LOCATOR_H
+
+#include <apf.h>
+#include <apfMesh.h>
+#include <vector>
+
+namespace pc {
+
+  /* bounding volume hierarchy over the element boxes of one mesh part */
+  struct PointLocator {
+    apf::Mesh* mesh;
+    std::vector<apf::MeshEntity*> elms;
+    std::vector<int> tags;       // model region tag of each element
+    std::vector<double> elmBoxes; // 6 per element: min xyz, max xyz
+    std::vector<double> boxes;   // 6 per node
+    std::vector<int> first;      // leaf: first element, inner: -1
+    std::vector<int> count;      // leaf: element count, inner: right child
+    std::vector<int> order;      // elements sorted into leaf order
+  };
+
+  /* build the locator for the local part; with a cache prefix the tree is
+     read from <prefix>_<rank>.bvh when it matches the mesh, and written
+     there otherwise */
+  PointLocator* buildPointLocator(apf::Mesh* m, const char* cachePrefix = 0);
+
+  void destroyPointLocator(PointLocator* pl);
+
+  /* closest element to x classified on model region tag (any region if
+     tag < 0); xi gets its parent coordinates and dist the distance from
+     x to the element, zero when x is inside. returns 0 if the part has
+     no such element. queries only read the locator, so threads may
+     share one */
+  apf::MeshEntity* locatePoint(PointLocator* pl, apf::Vector3 const& x,
+                               int tag, apf::Vector3& xi, double& dist);
+
+  /* same, but first walk face neighbors from the hint element, which is
+     usually the element found for a nearby point */
+  apf::MeshEntity* locatePointFrom(PointLocator* pl, apf::Vector3 const& x,
+                                   int tag, apf::MeshEntity* hint,
+                                   apf::Vector3& xi, double& dist);
+
+  /* locate a batch of points in Morton order so that each walk starts
+     next to the previous answer; elms[i] is 0 for unlocated points */
+  void locatePoints(PointLocator* pl, std::vector<apf::Vector3> const& x,
+                    std::vector<int> const& tags,
+                    std::vector<apf::MeshEntity*>& elms,
+                    std::vector<apf::Vector3>& xi,
+                    std::vector<double>& dist);
+
+}
+
+#endif
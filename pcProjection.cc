@@ -0,0 +1,535 @@
+#include "pcProjection.h"
+#include "pcAdapter.h"
+#include "pcPointLocator.h"
+#include <apfSIM.h>
+#include <apfShape.h>
+#include <SimField.h>
+#include <PCU.h>
+#include <pcu_util.h>
+#include <phasta.h>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <vector>
+
+namespace pc {
+
+  /* Sparse interpolation operator from source vertices to the destination
+     points of every part. Row r lives on the source part that won point
+     rowQid[r] of part rowPeer[r]; it is the weighted sum of the source
+     vertices cols[rowOffsets[r]..rowOffsets[r+1]). It is built once and
+     applied to any number of fields and time steps. */
+  struct ProjectionOperator {
+    std::vector<bool> found;          // per destination point of this part
+    std::vector<int> rowPeer;
+    std::vector<int> rowQid;
+    std::vector<int> rowOffsets;
+    std::vector<int> cols;
+    std::vector<double> weights;
+    std::vector<apf::MeshEntity*> srcVerts; // column -> source vertex
+  };
+
+}
+
+namespace {
+
+  /* bounding box (min xyz, max xyz) of every part of the mesh */
+  void gatherPartBoxes(apf::Mesh* m, std::vector<double>& boxes) {
+    double box[6] = {1e300, 1e300, 1e300, -1e300, -1e300, -1e300};
+    apf::Vector3 p;
+    apf::MeshEntity* v;
+    apf::MeshIterator* vit = m->begin(0);
+    while ((v = m->iterate(vit))) {
+      m->getPoint(v, 0, p);
+      for (int i = 0; i < 3; i++) {
+        box[i]   = std::min(box[i], p[i]);
+        box[i+3] = std::max(box[i+3], p[i]);
+      }
+    }
+    m->end(vit);
+    boxes.resize(6*PCU_Comm_Peers());
+    MPI_Allgather(box, 6, MPI_DOUBLE, &boxes[0], 6, MPI_DOUBLE, PCU_Get_Comm());
+  }
+
+  double distanceToBox(const double* box, apf::Vector3 const& p) {
+    double d2 = 0.0;
+    for (int i = 0; i < 3; i++) {
+      double d = 0.0;
+      if (p[i] < box[i])
+        d = box[i] - p[i];
+      else if (p[i] > box[i+3])
+        d = p[i] - box[i+3];
+      d2 += d*d;
+    }
+    return sqrt(d2);
+  }
+
+  /* bounding volume hierarchy over the part boxes, laid out like the
+     element tree of pcPointLocator, so routing a point costs
+     O(log peers) instead of a scan over all parts */
+  struct PartBoxTree {
+    std::vector<double> partBoxes; // 6 per part
+    std::vector<double> boxes;     // 6 per node
+    std::vector<int> first;        // leaf: first part, inner: -1
+    std::vector<int> count;        // leaf: part count, inner: right child
+    std::vector<int> order;        // parts sorted into leaf order
+  };
+
+  const int partLeafSize = 4;
+
+  struct PartCenterLess {
+    const std::vector<double>* partBoxes;
+    int axis;
+    bool operator()(int a, int b) const {
+      const double* ba = &(*partBoxes)[6*a];
+      const double* bb = &(*partBoxes)[6*b];
+      return ba[axis] + ba[axis+3] < bb[axis] + bb[axis+3];
+    }
+  };
+
+  void buildPartNode(PartBoxTree& t, int begin, int end) {
+    int node = t.first.size();
+    t.first.push_back(-1);
+    t.count.push_back(0);
+    double box[6] = {1e300, 1e300, 1e300, -1e300, -1e300, -1e300};
+    for (int k = begin; k < end; k++) {
+      const double* pb = &t.partBoxes[6*t.order[k]];
+      for (int i = 0; i < 3; i++) {
+        box[i]   = std::min(box[i], pb[i]);
+        box[i+3] = std::max(box[i+3], pb[i+3]);
+      }
+    }
+    t.boxes.insert(t.boxes.end(), box, box + 6);
+    if (end - begin <= partLeafSize) {
+      t.first[node] = begin;
+      t.count[node] = end - begin;
+      return;
+    }
+    int axis = 0;
+    for (int i = 1; i < 3; i++)
+      if (box[i+3] - box[i] > box[axis+3] - box[axis])
+        axis = i;
+    PartCenterLess less;
+    less.partBoxes = &t.partBoxes;
+    less.axis = axis;
+    int mid = (begin + end) / 2;
+    std::nth_element(t.order.begin() + begin, t.order.begin() + mid,
+                     t.order.begin() + end, less);
+    buildPartNode(t, begin, mid);
+    t.count[node] = t.first.size();
+    buildPartNode(t, mid, end);
+  }
+
+  void buildPartBoxTree(apf::Mesh* m, PartBoxTree& t) {
+    gatherPartBoxes(m, t.partBoxes);
+    int peers = t.partBoxes.size() / 6;
+    t.order.resize(peers);
+    for (int p = 0; p < peers; p++)
+      t.order[p] = p;
+    buildPartNode(t, 0, peers);
+  }
+
+  /* the parts whose box is nearest to x: all parts whose box contains it,
+     or the nearest boxes (ties included) when none does */
+  void nearestParts(PartBoxTree const& t, apf::Vector3 const& x,
+                    std::vector<int>& parts) {
+    parts.clear();
+    double dmin = 1e300;
+    const int maxStack = 128;
+    int stack[maxStack];
+    int top = 0;
+    stack[top++] = 0;
+    while (top) {
+      int node = stack[--top];
+      if (distanceToBox(&t.boxes[6*node], x) > dmin)
+        continue;
+      if (t.first[node] < 0) {
+        int left = node + 1;
+        int right = t.count[node];
+        // visit the nearer child first
+        if (distanceToBox(&t.boxes[6*left], x) < distanceToBox(&t.boxes[6*right], x))
+          std::swap(left, right);
+        assert(top + 2 <= maxStack);
+        stack[top++] = left;
+        stack[top++] = right;
+        continue;
+      }
+      for (int k = 0; k < t.count[node]; k++) {
+        int p = t.order[t.first[node] + k];
+        double d = distanceToBox(&t.partBoxes[6*p], x);
+        if (d < dmin) {
+          dmin = d;
+          parts.clear();
+        }
+        if (d <= dmin)
+          parts.push_back(p);
+      }
+    }
+  }
+
+  /* Both meshes stay partitioned. Every point is sent to the source parts
+     whose bounding box contains it (or to the nearest boxes if none does),
+     those parts locate it in their point locator and reply with the
+     distance, and the part with the closest answer keeps the row. */
+  pc::ProjectionOperator* buildProjectionOperator(apf::Mesh* src_m,
+      std::vector<apf::Vector3> const& pts, std::vector<int> const& tags) {
+    pc::ProjectionOperator* op = new pc::ProjectionOperator();
+    pc::PointLocator* locator = pc::buildPointLocator(src_m);
+    PartBoxTree partTree;
+    buildPartBoxTree(src_m, partTree);
+
+    // send every query to the source parts that may contain it
+    std::vector<int> parts;
+    PCU_Comm_Begin();
+    for (size_t q = 0; q < pts.size(); q++) {
+      nearestParts(partTree, pts[q], parts);
+      for (size_t i = 0; i < parts.size(); i++) {
+        int p = parts[i];
+        int qid = q;
+        PCU_COMM_PACK(p, qid);
+        PCU_COMM_PACK(p, tags[q]);
+        PCU_Comm_Pack(p, &(pts[q][0]), 3*sizeof(double));
+      }
+    }
+    PCU_Comm_Send();
+
+    // locate the received points and keep a candidate row for each
+    std::vector<int> rQid, rFrom, rTag;
+    std::vector<apf::Vector3> rPts;
+    while (PCU_Comm_Receive()) {
+      int qid, tag;
+      apf::Vector3 xyz;
+      PCU_COMM_UNPACK(qid);
+      PCU_COMM_UNPACK(tag);
+      PCU_Comm_Unpack(&xyz[0], 3*sizeof(double));
+      rQid.push_back(qid);
+      rFrom.push_back(PCU_Comm_Sender());
+      rTag.push_back(tag);
+      rPts.push_back(xyz);
+    }
+    std::vector<apf::MeshEntity*> rElms;
+    std::vector<apf::Vector3> rXi;
+    std::vector<double> rDist;
+    pc::locatePoints(locator, rPts, rTag, rElms, rXi, rDist);
+    pc::destroyPointLocator(locator);
+    PCU_Comm_Begin();
+    for (size_t r = 0; r < rQid.size(); r++) {
+      if (!rElms[r])
+        continue;
+      int row = r;
+      PCU_COMM_PACK(rFrom[r], rQid[r]);
+      PCU_COMM_PACK(rFrom[r], rDist[r]);
+      PCU_COMM_PACK(rFrom[r], row);
+    }
+    PCU_Comm_Send();
+
+    // keep the closest answer for each point
+    std::vector<double> qDist(pts.size(), 1e300);
+    std::vector<int> qPeer(pts.size(), -1);
+    std::vector<int> qRow(pts.size(), -1);
+    while (PCU_Comm_Receive()) {
+      int qid, row;
+      double dist;
+      PCU_COMM_UNPACK(qid);
+      PCU_COMM_UNPACK(dist);
+      PCU_COMM_UNPACK(row);
+      if (qPeer[qid] >= 0 && dist >= qDist[qid])
+        continue;
+      qDist[qid] = dist;
+      qPeer[qid] = PCU_Comm_Sender();
+      qRow[qid] = row;
+    }
+    op->found.resize(pts.size());
+    PCU_Comm_Begin();
+    for (size_t q = 0; q < pts.size(); q++) {
+      op->found[q] = qPeer[q] >= 0;
+      if (op->found[q])
+        PCU_COMM_PACK(qPeer[q], qRow[q]);
+    }
+    PCU_Comm_Send();
+
+    // the winning rows get the linear shape function weights
+    apf::MeshTag* colTag = src_m->createIntTag("proj_col", 1);
+    apf::FieldShape* shape = apf::getLagrange(1);
+    apf::NewArray<double> N;
+    op->rowOffsets.push_back(0);
+    while (PCU_Comm_Receive()) {
+      int row;
+      PCU_COMM_UNPACK(row);
+      apf::MeshEntity* e = rElms[row];
+      apf::Downward verts;
+      int nv = src_m->getDownward(e, 0, verts);
+      shape->getEntityShape(src_m->getType(e))->getValues(src_m, e, rXi[row], N);
+      for (int a = 0; a < nv; a++) {
+        int col;
+        if (src_m->hasTag(verts[a], colTag))
+          src_m->getIntTag(verts[a], colTag, &col);
+        else {
+          col = op->srcVerts.size();
+          src_m->setIntTag(verts[a], colTag, &col);
+          op->srcVerts.push_back(verts[a]);
+        }
+        op->cols.push_back(col);
+        op->weights.push_back(N[a]);
+      }
+      op->rowPeer.push_back(rFrom[row]);
+      op->rowQid.push_back(rQid[row]);
+      op->rowOffsets.push_back(op->cols.size());
+    }
+    for (size_t c = 0; c < op->srcVerts.size(); c++)
+      src_m->removeTag(op->srcVerts[c], colTag);
+    src_m->destroyTag(colTag);
+    return op;
+  }
+
+  /* apply the operator to vertex fields of the source mesh: the field
+     values are gathered once per source vertex, every row is a small
+     dot product, and each part gets compOffsets.back() values per point */
+  void applyProjectionOperator(pc::ProjectionOperator* op,
+                               std::vector<apf::Field*> const& fields,
+                               std::vector<int> const& compOffsets,
+                               std::vector<double>& vals) {
+    int totalComp = compOffsets.back();
+    std::vector<double> colVals(op->srcVerts.size()*totalComp);
+    for (size_t c = 0; c < op->srcVerts.size(); c++)
+      for (size_t i = 0; i < fields.size(); i++)
+        apf::getComponents(fields[i], op->srcVerts[c], 0,
+                           &colVals[c*totalComp + compOffsets[i]]);
+    std::vector<double> rowVals(totalComp);
+    PCU_Comm_Begin();
+    for (size_t r = 0; r < op->rowQid.size(); r++) {
+      std::fill(rowVals.begin(), rowVals.end(), 0.0);
+      for (int k = op->rowOffsets[r]; k < op->rowOffsets[r+1]; k++) {
+        const double* cv = &colVals[op->cols[k]*totalComp];
+        for (int j = 0; j < totalComp; j++)
+          rowVals[j] += op->weights[k] * cv[j];
+      }
+      PCU_COMM_PACK(op->rowPeer[r], op->rowQid[r]);
+      PCU_Comm_Pack(op->rowPeer[r], &rowVals[0], totalComp*sizeof(double));
+    }
+    PCU_Comm_Send();
+    vals.assign(op->found.size()*totalComp, 0.0);
+    while (PCU_Comm_Receive()) {
+      int qid;
+      PCU_COMM_UNPACK(qid);
+      PCU_Comm_Unpack(&vals[qid*totalComp], totalComp*sizeof(double));
+    }
+  }
+
+  /* the source fields of a projection */
+  struct SourceFields {
+    apf::Mesh* mesh;
+    std::vector<apf::Field*> fields;
+    std::vector<int> compOffsets;
+  };
+
+  /* pointwise interpolation at the owned destination vertices */
+  void projectToVertices(SourceFields& src, apf::Mesh2* dst_m,
+                         std::vector<apf::Field*>& dst_flds,
+                         pc::ProjectionOperator*& op) {
+    int totalComp = src.compOffsets.back();
+    std::vector<apf::MeshEntity*> qVtx;
+    std::vector<apf::Vector3> qPts;
+    std::vector<int> qTags;
+    apf::Adjacent adjRgn;
+    apf::MeshEntity* v;
+    apf::MeshIterator* vit = dst_m->begin(0);
+    while ((v = dst_m->iterate(vit))) {
+      if (!dst_m->isOwned(v))
+        continue;
+      dst_m->getAdjacent(v, 3, adjRgn);
+      if (!adjRgn.getSize())
+        continue;
+      apf::Vector3 p;
+      dst_m->getPoint(v, 0, p);
+      qVtx.push_back(v);
+      qPts.push_back(p);
+      qTags.push_back(dst_m->getModelTag(dst_m->toModel(adjRgn[0])));
+    }
+    dst_m->end(vit);
+
+    if (!op)
+      op = buildProjectionOperator(src.mesh, qPts, qTags);
+    std::vector<double> qVals;
+    applyProjectionOperator(op, src.fields, src.compOffsets, qVals);
+
+    for (size_t q = 0; q < qPts.size(); q++) {
+      if (!op->found[q]) {
+        printf("cannot find mesh region by point (%f,%f,%f)\n",
+               qPts[q][0], qPts[q][1], qPts[q][2]);
+        continue;
+      }
+      for (size_t i = 0; i < dst_flds.size(); i++)
+        apf::setComponents(dst_flds[i], qVtx[q], 0,
+                           &qVals[q*totalComp + src.compOffsets[i]]);
+    }
+    for (size_t i = 0; i < dst_flds.size(); i++)
+      apf::synchronize(dst_flds[i]);
+  }
+
+  /* lumped mass L2 projection: the source fields are sampled at the
+     destination quadrature points and each vertex gets
+     int(N_a f) / int(N_a). what is conserved is the integral of the
+     sampled source field under the destination quadrature, not the
+     exact integral of the source field */
+  void projectL2(SourceFields& src, apf::Mesh2* dst_m,
+                 std::vector<apf::Field*>& dst_flds, int order,
+                 pc::ProjectionOperator*& op) {
+    int totalComp = src.compOffsets.back();
+    int dim = dst_m->getDimension();
+    std::vector<apf::MeshEntity*> qElm;
+    std::vector<apf::Vector3> qLocal;
+    std::vector<apf::Vector3> qPts;
+    std::vector<int> qTags;
+    std::vector<double> qWts;
+    apf::MeshEntity* e;
+    apf::MeshIterator* eit = dst_m->begin(dim);
+    while ((e = dst_m->iterate(eit))) {
+      int tag = dst_m->getModelTag(dst_m->toModel(e));
+      apf::MeshElement* me = apf::createMeshElement(dst_m, e);
+      int numqpt = apf::countIntPoints(me, order);
+      for (int i = 0; i < numqpt; i++) {
+        apf::Vector3 qpt;
+        apf::Vector3 xyz;
+        apf::getIntPoint(me, order, i, qpt);
+        apf::mapLocalToGlobal(me, qpt, xyz);
+        qElm.push_back(e);
+        qLocal.push_back(qpt);
+        qPts.push_back(xyz);
+        qTags.push_back(tag);
+        qWts.push_back(apf::getIntWeight(me, order, i) * apf::getDV(me, qpt));
+      }
+      apf::destroyMeshElement(me);
+    }
+    dst_m->end(eit);
+
+    if (!op)
+      op = buildProjectionOperator(src.mesh, qPts, qTags);
+    std::vector<double> qVals;
+    applyProjectionOperator(op, src.fields, src.compOffsets, qVals);
+
+    // assemble int(N_a f) and int(N_a) on the vertices of every part
+    apf::Field* rhs = apf::createPackedField(dst_m, "l2_rhs", totalComp);
+    apf::Field* mass = apf::createLagrangeField(dst_m, "l2_mass", apf::SCALAR, 1);
+    apf::zeroField(rhs);
+    apf::zeroField(mass);
+    apf::FieldShape* shape = apf::getLagrange(1);
+    apf::NewArray<double> N;
+    std::vector<double> nodeVals(totalComp);
+    int notFound = 0;
+    for (size_t q = 0; q < qPts.size(); q++) {
+      if (!op->found[q]) {
+        notFound++;
+        continue;
+      }
+      apf::Downward verts;
+      int nv = dst_m->getDownward(qElm[q], 0, verts);
+      shape->getEntityShape(dst_m->getType(qElm[q]))
+           ->getValues(dst_m, qElm[q], qLocal[q], N);
+      for (int a = 0; a < nv; a++) {
+        double w = N[a] * qWts[q];
+        apf::getComponents(rhs, verts[a], 0, &nodeVals[0]);
+        for (int c = 0; c < totalComp; c++)
+          nodeVals[c] += w * qVals[q*totalComp + c];
+        apf::setComponents(rhs, verts[a], 0, &nodeVals[0]);
+        apf::setScalar(mass, verts[a], 0, apf::getScalar(mass, verts[a], 0) + w);
+      }
+    }
+    apf::accumulate(rhs);
+    apf::accumulate(mass);
+    notFound = PCU_Add_Int(notFound);
+    if(!PCU_Comm_Self() && notFound)
+      printf("%d quadrature points were not found in the source mesh\n", notFound);
+
+    // solve the lumped system
+    apf::MeshEntity* v;
+    apf::MeshIterator* vit = dst_m->begin(0);
+    while ((v = dst_m->iterate(vit))) {
+      double m_a = apf::getScalar(mass, v, 0);
+      if (m_a <= 0.0) {
+        apf::Vector3 p;
+        dst_m->getPoint(v, 0, p);
+        printf("no projected mass at point (%f,%f,%f)\n", p[0], p[1], p[2]);
+        continue;
+      }
+      apf::getComponents(rhs, v, 0, &nodeVals[0]);
+      for (int c = 0; c < totalComp; c++)
+        nodeVals[c] /= m_a;
+      for (size_t i = 0; i < dst_flds.size(); i++)
+        apf::setComponents(dst_flds[i], v, 0, &nodeVals[src.compOffsets[i]]);
+    }
+    dst_m->end(vit);
+    apf::destroyField(rhs);
+    apf::destroyField(mass);
+  }
+
+} //end namespace
+
+namespace pc {
+
+  void projectFields(apf::Mesh2* src_m, apf::Mesh2* dst_m, int l2Order,
+                     ProjectionOperator*& op) {
+    // drop what the previous step left on the destination mesh
+    const char* projected[4] = {"solution", "time derivative of solution",
+                                "mesh_vel", "err_tri_f"};
+    for (int i = 0; i < 4; i++)
+      if (dst_m->findField(projected[i]))
+        apf::destroyField(dst_m->findField(projected[i]));
+
+    // load fields
+    phSolver::Input inp("solver.inp", "input.config");
+    int num_flds = getNumOfMappedFields(src_m, inp);
+    pField* src_flds = new pField[num_flds];
+    removeOtherFields(src_m, inp);
+    int num_chck = getSimFields(src_m, 1, src_flds, inp);
+    PCU_ALWAYS_ASSERT(num_chck == num_flds);
+
+    // create fields on destination mesh
+    int valueType = 0;
+    int totalComp = 0;
+    std::vector<int> compOffsets(num_flds + 1, 0);
+    std::vector<apf::Field*> dst_flds(num_flds);
+    for(int i = 0; i < num_flds; i++) {
+      int numOfComp = Field_numComp(src_flds[i]);
+      if (numOfComp == 1)
+        valueType = apf::SCALAR;
+      else if (numOfComp == 3)
+        valueType = apf::VECTOR;
+      else if (numOfComp == 9)
+        valueType = apf::MATRIX;
+      else {
+        printf("error: number of components is not correct!\n");
+        assert(0);
+      }
+      totalComp += numOfComp;
+      compOffsets[i+1] = totalComp;
+      if(dst_m->findField(Field_name(src_flds[i])))
+        apf::destroyField(dst_m->findField(Field_name(src_flds[i])));
+      if(!PCU_Comm_Self())
+        printf("create a sim field %s on destination mesh\n", Field_name(src_flds[i]));
+      dst_flds[i] = apf::createSIMFieldOn(dst_m, Field_name(src_flds[i]), valueType);
+    }
+
+    // project with the operator of the local source part
+    SourceFields src;
+    src.mesh = src_m;
+    src.compOffsets = compOffsets;
+    src.fields.resize(num_flds);
+    for (int i = 0; i < num_flds; i++)
+      src.fields[i] = src_m->findField(Field_name(src_flds[i]));
+    if (l2Order > 0)
+      projectL2(src, dst_m, dst_flds, l2Order, op);
+    else
+      projectToVertices(src, dst_m, dst_flds, op);
+    delete [] src_flds;
+
+    // transfer fields
+    transferSimFields(dst_m);
+  }
+
+  void destroyProjectionOperator(ProjectionOperator* op) {
+    delete op;
+  }
+
+}
@@ -0,0 +1,24 @@
+#ifndef PC_PROJECTION_H
+#define PC_PROJECTION_H
+
+#include <apf.h>
+#include <apfMesh2.h>
+
+namespace pc {
+
+  struct ProjectionOperator;
+
+  /* project the solution, its time derivative, mesh velocity and error
+     fields of src_m onto dst_m, both partitioned. l2Order > 0 selects the
+     lumped mass L2 projection with that integration order, otherwise the
+     source is interpolated at the destination vertices. op is built on
+     the first call (pass it null) and reused while both meshes stay as
+     they are. */
+  void projectFields(apf::Mesh2* src_m, apf::Mesh2* dst_m, int l2Order,
+                     ProjectionOperator*& op);
+
+  void destroyProjectionOperator(ProjectionOperator* op);
+
+}
+
+#endif
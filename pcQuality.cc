@@ -0,0 +1,266 @@
+#include "pcQuality.h"
+#include "pcInput.h"
+#include <PCU.h>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+
+namespace {
+
+  const double pi = 3.14159265358979323846;
+
+  void getTetPoints(apf::Mesh* m, apf::MeshEntity* e, apf::Vector3* p) {
+    apf::Downward verts;
+    m->getDownward(e, 0, verts);
+    for (int i = 0; i < 4; i++)
+      m->getPoint(verts[i], 0, p[i]);
+  }
+
+  double getTetMeanRatio(apf::Vector3 const* p) {
+    double vol = ((p[1] - p[0]) * apf::cross(p[2] - p[0], p[3] - p[0])) / 6.0;
+    double l2 = 0.0;
+    for (int i = 0; i < 4; i++)
+      for (int j = i + 1; j < 4; j++)
+        l2 += (p[j] - p[i]) * (p[j] - p[i]);
+    return vol > 0.0 ? 12.0 * pow(3.0 * vol, 2.0 / 3.0) / l2 : 0.0;
+  }
+
+  double getTetMinDihedral(apf::Vector3 const* p) {
+    // outward normal of the face opposite each vertex
+    apf::Vector3 n[4];
+    for (int i = 0; i < 4; i++) {
+      apf::Vector3 const& a = p[(i + 1) % 4];
+      apf::Vector3 const& b = p[(i + 2) % 4];
+      apf::Vector3 const& c = p[(i + 3) % 4];
+      n[i] = apf::cross(b - a, c - a);
+      if ((p[i] - a) * n[i] > 0.0)
+        n[i] = n[i] * -1.0;
+    }
+    double minAngle = pi;
+    for (int i = 0; i < 4; i++)
+      for (int j = i + 1; j < 4; j++) {
+        double c = (n[i] * n[j]) / (n[i].getLength() * n[j].getLength());
+        c = std::max(-1.0, std::min(1.0, c));
+        double angle = pi - acos(c);
+        if (angle < minAngle)
+          minAngle = angle;
+      }
+    return minAngle;
+  }
+
+  /* parent coordinates where the Jacobian of a linear prism, pyramid or
+     hex is checked: its corners, except the degenerate pyramid apex,
+     which is replaced by the pyramid center */
+  const double prismCorners[6][3] = {
+    {0,0,-1}, {1,0,-1}, {0,1,-1}, {0,0,1}, {1,0,1}, {0,1,1}};
+  const double pyramidCorners[5][3] = {
+    {-1,-1,-1}, {1,-1,-1}, {1,1,-1}, {-1,1,-1}, {0,0,0}};
+  const double hexCorners[8][3] = {
+    {-1,-1,-1}, {1,-1,-1}, {1,1,-1}, {-1,1,-1},
+    {-1,-1,1}, {1,-1,1}, {1,1,1}, {-1,1,1}};
+
+  /* whether any corner Jacobian of a non-tet element is not positive */
+  bool isInverted(apf::Mesh* m, apf::MeshEntity* e) {
+    const double (*corners)[3] = 0;
+    int n = 0;
+    switch (m->getType(e)) {
+      case apf::Mesh::PRISM:   corners = prismCorners;   n = 6; break;
+      case apf::Mesh::PYRAMID: corners = pyramidCorners; n = 5; break;
+      case apf::Mesh::HEX:     corners = hexCorners;     n = 8; break;
+      default: return false;
+    }
+    apf::MeshElement* me = apf::createMeshElement(m, e);
+    bool inverted = false;
+    for (int i = 0; i < n && !inverted; i++) {
+      apf::Vector3 xi(corners[i][0], corners[i][1], corners[i][2]);
+      apf::Matrix3x3 J;
+      apf::getJacobian(me, xi, J);
+      inverted = apf::getJacobianDeterminant(J, 3) <= 0.0;
+    }
+    apf::destroyMeshElement(me);
+    return inverted;
+  }
+
+  /* dihedral angle and mean ratio of a tet; other elements only count
+     through inversion, which gives them a quality of zero */
+  void measureElement(apf::Mesh* m, apf::MeshEntity* e, double* q) {
+    if (m->getType(e) == apf::Mesh::TET) {
+      apf::Vector3 p[4];
+      getTetPoints(m, e, p);
+      q[1] = getTetMeanRatio(p);
+      q[0] = q[1] > 0.0 ? getTetMinDihedral(p) : 0.0;
+      return;
+    }
+    bool inverted = isInverted(m, e);
+    q[0] = inverted ? 0.0 : pi;
+    q[1] = inverted ? 0.0 : 1.0;
+  }
+
+  /* min, min, sum over QualityStats packed as three doubles */
+  void reduceQualityStats(void* in, void* inout, int* len, MPI_Datatype*) {
+    double* a = static_cast<double*>(in);
+    double* b = static_cast<double*>(inout);
+    for (int i = 0; i < 3 * *len; i += 3) {
+      b[i] = std::min(a[i], b[i]);
+      b[i + 1] = std::min(a[i + 1], b[i + 1]);
+      b[i + 2] += a[i + 2];
+    }
+  }
+
+  bool samePoint(apf::Vector3 const& a, double const* b) {
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+  }
+
+}
+
+namespace pc {
+
+  QualityLimits getQualityLimits(phSolver::Input& inp) {
+    QualityLimits limits;
+    limits.adaptOnDemand = getOptionalInt(inp, "Quality Triggered Adaptation", 0);
+    limits.improve = getOptionalInt(inp, "Improve Moved Mesh", 1);
+    limits.adaptQuality = getOptionalDouble(inp, "Adapt Quality Threshold", 0.2);
+    limits.adaptSizeDeviation = getOptionalDouble(inp, "Adapt Size Deviation Limit", 0.0);
+    limits.remeshQuality = getOptionalDouble(inp, "Remesh Quality Threshold", 0.0);
+    return limits;
+  }
+
+  double getMaxSizeDeviation(apf::Mesh* m, apf::Field* szFld) {
+    double maxDev = 1.0;
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(1);
+    while ((e = m->iterate(it))) {
+      apf::MeshEntity* v[2];
+      m->getDownward(e, 0, v);
+      if (!apf::hasEntity(szFld, v[0]) || !apf::hasEntity(szFld, v[1]))
+        continue;
+      double h = 0.5 * (apf::getScalar(szFld, v[0], 0) +
+                        apf::getScalar(szFld, v[1], 0));
+      double len = apf::measure(m, e);
+      if (h <= 0.0 || len <= 0.0)
+        continue;
+      double dev = len > h ? len / h : h / len;
+      if (dev > maxDev)
+        maxDev = dev;
+    }
+    m->end(it);
+    return PCU_Max_Double(maxDev);
+  }
+
+  QualityMonitor* createQualityMonitor() {
+    QualityMonitor* qm = new QualityMonitor();
+    qm->mesh = 0;
+    qm->coords = 0;
+    qm->quality = 0;
+    qm->numElms = -1;
+    return qm;
+  }
+
+  void releaseQualityMonitor(QualityMonitor* qm) {
+    if (!qm->mesh)
+      return;
+    apf::removeTagFromDimension(qm->mesh, qm->coords, 0);
+    qm->mesh->destroyTag(qm->coords);
+    apf::removeTagFromDimension(qm->mesh, qm->quality, 3);
+    qm->mesh->destroyTag(qm->quality);
+    qm->mesh = 0;
+  }
+
+  void destroyQualityMonitor(QualityMonitor* qm) {
+    releaseQualityMonitor(qm);
+    delete qm;
+  }
+
+  QualityStats updateQualityMonitor(QualityMonitor* qm, apf::Mesh* m) {
+    if (qm->mesh != m) {
+      releaseQualityMonitor(qm);
+      qm->mesh = m;
+      qm->coords = m->createDoubleTag("pc_quality_coords", 3);
+      qm->quality = m->createDoubleTag("pc_quality", 2);
+      qm->numElms = -1;
+    }
+    // forget the elements around vertices that moved or are new
+    bool changed = false;
+    apf::MeshEntity* v;
+    apf::MeshIterator* it = m->begin(0);
+    while ((v = m->iterate(it))) {
+      apf::Vector3 x;
+      m->getPoint(v, 0, x);
+      double old[3];
+      if (m->hasTag(v, qm->coords)) {
+        m->getDoubleTag(v, qm->coords, old);
+        if (samePoint(x, old))
+          continue;
+      }
+      changed = true;
+      x.toArray(old);
+      m->setDoubleTag(v, qm->coords, old);
+      apf::Adjacent elms;
+      m->getAdjacent(v, 3, elms);
+      for (size_t i = 0; i < elms.getSize(); i++)
+        if (m->hasTag(elms[i], qm->quality))
+          m->removeTag(elms[i], qm->quality);
+    }
+    m->end(it);
+    // with no vertex moved and as many elements as before the cached
+    // part stats still hold; otherwise measure the stale elements again
+    long numElms = m->count(3);
+    if (changed || numElms != qm->numElms) {
+      double* local = qm->local;
+      local[0] = pi;
+      local[1] = 1.0;
+      local[2] = 0.0;
+      apf::MeshEntity* e;
+      it = m->begin(3);
+      while ((e = m->iterate(it))) {
+        double q[2];
+        if (m->hasTag(e, qm->quality)) {
+          m->getDoubleTag(e, qm->quality, q);
+        }
+        else {
+          measureElement(m, e, q);
+          m->setDoubleTag(e, qm->quality, q);
+        }
+        local[0] = std::min(local[0], q[0]);
+        local[1] = std::min(local[1], q[1]);
+        if (q[1] <= 0.0)
+          local[2] += 1.0;
+      }
+      m->end(it);
+      qm->numElms = numElms;
+    }
+    static MPI_Datatype type = MPI_DATATYPE_NULL;
+    static MPI_Op op = MPI_OP_NULL;
+    if (op == MPI_OP_NULL) {
+      MPI_Type_contiguous(3, MPI_DOUBLE, &type);
+      MPI_Type_commit(&type);
+      MPI_Op_create(reduceQualityStats, 1, &op);
+    }
+    double global[3];
+    MPI_Allreduce(qm->local, global, 1, type, op, PCU_Get_Comm());
+    QualityStats stats;
+    stats.minDihedral = global[0];
+    stats.minQuality = global[1];
+    stats.inverted = (long)global[2];
+    if(!PCU_Comm_Self())
+      printf("mesh quality: minimum dihedral angle %f degrees, "
+             "minimum tet mean ratio %f, %ld inverted elements\n",
+             stats.minDihedral * 180.0 / pi, stats.minQuality, stats.inverted);
+    return stats;
+  }
+
+  bool needsAdapt(apf::Mesh* m, apf::Field* szFld, QualityStats const& stats,
+                  QualityLimits const& limits) {
+    double minq = stats.minQuality;
+    double dev = 1.0;
+    if (szFld && limits.adaptSizeDeviation > 0.0)
+      dev = getMaxSizeDeviation(m, szFld);
+    bool adapt = minq < limits.adaptQuality ||
+                 (limits.adaptSizeDeviation > 0.0 && dev > limits.adaptSizeDeviation);
+    if(!PCU_Comm_Self())
+      printf("moved mesh: minimum tet quality %f, size deviation %f, %s\n",
+             minq, dev, adapt ? "adapt" : "no adapt");
+    return adapt;
+  }
+
+}
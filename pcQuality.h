@@ -0,0 +1,66 @@
+#ifndef PC_QUALITY_H
+#define PC_QUALITY_H
+
+#include <apf.h>
+#include <apfMesh.h>
+#include <phasta.h>
+
+namespace pc {
+
+  /* limits read from solver.inp that decide how much mesh modification
+     a cycle gets */
+  struct QualityLimits {
+    int adaptOnDemand;         // move only, adapt when a limit is crossed
+    int improve;               // run the improver with an on-demand move
+    double adaptQuality;       // adapt below this tet mean ratio
+    double adaptSizeDeviation; // adapt above this edge/size ratio, 0 is off
+    double remeshQuality;      // remesh below this tet mean ratio, 0 is off
+  };
+
+  QualityLimits getQualityLimits(phSolver::Input& inp);
+
+  /* largest ratio, either way round, between an edge length and the
+     scalar target size szFld averaged at its vertices; vertices without
+     a size are skipped */
+  double getMaxSizeDeviation(apf::Mesh* m, apf::Field* szFld);
+
+  /* dihedral angles and mean ratios are measured on tets only; prisms,
+     pyramids and hexes count through a corner Jacobian inversion check,
+     where an inverted element has quality 0 */
+  struct QualityStats {
+    double minDihedral; // radians
+    double minQuality;  // tet mean ratio, a volume-length ratio in (0,1]
+    long inverted;      // elements of any type
+  };
+
+  /* keeps the last measured quality of each element and the vertex
+     coordinates it was measured with, so an update only measures the
+     elements around vertices that moved or were created since. when
+     nothing moved and the element count is unchanged the element sweep
+     is skipped and the cached part stats are reduced again */
+  struct QualityMonitor {
+    apf::Mesh* mesh;
+    apf::MeshTag* coords;
+    apf::MeshTag* quality;
+    long numElms;     // elements at the last sweep, -1 for none yet
+    double local[3];  // part stats of that sweep, packed for the reduction
+  };
+
+  QualityMonitor* createQualityMonitor();
+
+  /* drop the tags from the monitored mesh; call before destroying it */
+  void releaseQualityMonitor(QualityMonitor* qm);
+
+  void destroyQualityMonitor(QualityMonitor* qm);
+
+  /* refresh the stale tets and reduce the stats over all parts with a
+     single collective; moving to another mesh releases the old one */
+  QualityStats updateQualityMonitor(QualityMonitor* qm, apf::Mesh* m);
+
+  /* whether a moved mesh crossed the adapt limits */
+  bool needsAdapt(apf::Mesh* m, apf::Field* szFld, QualityStats const& stats,
+                  QualityLimits const& limits);
+
+}
+
+#endif
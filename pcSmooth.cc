@@ -8,9 +8,15 @@
 #include <PCU.h>
 #include <cassert>
 #include <queue>
+#include <set>
+#include <vector>
+#include <functional>
+#include <list>
+#include <map>
 #include <iostream>
 #include <algorithm>
 #include <ph.h>
+#include <apfNumbering.h>
 #include <phastaChef.h>
 
 /* This part of code was originally written by Alvin Zhang */
@@ -37,260 +43,568 @@ bool isInCylinder(apf::MeshEntity* edge) {
   return false;
 }
 
-int gradeSizeModify(apf::Mesh* m, double gradingFactor,
-    double size[2], apf::Adjacent edgAdjVert,
-    apf::Adjacent vertAdjEdg,
-    std::queue<apf::MeshEntity*> &markedEdges,
-    apf::MeshTag* isMarked,
-    int idxFlag)
+typedef std::pair<double, int> SizedVertex;
+typedef std::priority_queue<SizedVertex, std::vector<SizedVertex>,
+                            std::greater<SizedVertex> > SizeHeap;
+
+double getIsoSize(apf::Field* sizes, apf::MeshEntity* v)
+{
+  apf::Vector3 v_mag = apf::Vector3(0.0,0.0,0.0);
+  apf::getVector(sizes,v,0,v_mag);
+  return v_mag[0];
+}
+
+void setIsoSize(apf::Field* sizes, apf::MeshEntity* v, double h)
+{
+  apf::setVector(sizes,v,0,apf::Vector3(h,h,h));
+}
+
+/* Vertex graph of the mesh edges in compressed row form, built once per
+   gradation call. Sizes live in a dense array while grading and the
+   remote copies of each vertex are stored by their index on the remote
+   part, so grading never goes back to the mesh. */
+struct GradeGraph {
+  std::vector<apf::MeshEntity*> verts;
+  std::vector<int> adjOffsets;
+  std::vector<int> adj;
+  std::vector<double> size;
+  std::vector<int> copyOffsets;
+  std::vector<int> copyParts;
+  std::vector<int> copyIndices;
+  //shared vertices whose size changed since they were last sent
+  std::vector<bool> changed;
+  std::vector<int> changedList;
+};
+
+struct RemoteCopy {
+  int local;
+  int part;
+  int remote;
+  bool operator<(const RemoteCopy& o) const { return local < o.local; }
+};
+
+void buildGradeGraph(apf::Mesh* m, apf::Field* sizes, GradeGraph& g)
 {
-  //Determine a switching scheme depending on which vertex needs a modification
-  int idx1,idx2;
-  if(idxFlag == 0){
-    idx1=0;
-    idx2=1;
+  apf::Numbering* nums = apf::numberOverlapDimension(m, "grade_vtx", 0);
+  int nv = m->count(0);
+  g.verts.resize(nv);
+  g.size.resize(nv);
+  apf::MeshEntity* v;
+  apf::MeshIterator* it = m->begin(0);
+  while((v=m->iterate(it))){
+    int i = apf::getNumber(nums,v,0,0);
+    g.verts[i] = v;
+    g.size[i] = getIsoSize(sizes,v);
   }
-  else{
-    idx1=1;
-    idx2 = 0;
+  m->end(it);
+
+  //each edge appears in the rows of both of its vertices
+  std::vector<int> edgeVerts;
+  edgeVerts.reserve(2*m->count(1));
+  g.adjOffsets.assign(nv+1,0);
+  apf::MeshEntity* edge;
+  apf::MeshEntity* ev[2];
+  it = m->begin(1);
+  while((edge=m->iterate(it))){
+    m->getDownward(edge, 0, ev);
+    int a = apf::getNumber(nums,ev[0],0,0);
+    int b = apf::getNumber(nums,ev[1],0,0);
+    edgeVerts.push_back(a);
+    edgeVerts.push_back(b);
+    ++g.adjOffsets[a+1];
+    ++g.adjOffsets[b+1];
+  }
+  m->end(it);
+  for (int i=0; i<nv; ++i)
+    g.adjOffsets[i+1] += g.adjOffsets[i];
+  g.adj.resize(g.adjOffsets[nv]);
+  std::vector<int> fill(g.adjOffsets.begin(), g.adjOffsets.end()-1);
+  for (std::size_t i=0; i<edgeVerts.size(); i+=2){
+    g.adj[fill[edgeVerts[i]]++] = edgeVerts[i+1];
+    g.adj[fill[edgeVerts[i+1]]++] = edgeVerts[i];
   }
 
-  int marker[3] = {0,1,0};
-  double marginVal = 0.01;
-  int needsParallel=0;
-  apf::Vector3 v_mag = apf::Vector3(0.0,0.0,0.0);
+  //learn the index of every remote copy from the part holding it
+  PCU_Comm_Begin();
+  apf::Copies remotes;
+  for (int i=0; i<nv; ++i){
+    if(!m->isShared(g.verts[i]))
+      continue;
+    m->getRemotes(g.verts[i],remotes);
+    APF_ITERATE(apf::Copies, remotes, rit){
+      PCU_COMM_PACK(rit->first, rit->second);
+      PCU_COMM_PACK(rit->first, i);
+    }
+  }
+  PCU_Comm_Send();
+  std::vector<RemoteCopy> copies;
+  while(PCU_Comm_Receive()){
+    RemoteCopy c;
+    PCU_COMM_UNPACK(v);
+    PCU_COMM_UNPACK(c.remote);
+    c.local = apf::getNumber(nums,v,0,0);
+    c.part = PCU_Comm_Sender();
+    copies.push_back(c);
+  }
+  std::sort(copies.begin(), copies.end());
+  g.copyOffsets.assign(nv+1,0);
+  g.copyParts.resize(copies.size());
+  g.copyIndices.resize(copies.size());
+  for (std::size_t i=0; i<copies.size(); ++i){
+    ++g.copyOffsets[copies[i].local+1];
+    g.copyParts[i] = copies[i].part;
+    g.copyIndices[i] = copies[i].remote;
+  }
+  for (int i=0; i<nv; ++i)
+    g.copyOffsets[i+1] += g.copyOffsets[i];
 
-  apf::Field* sizes = m->findField("sizes");
+  g.changed.assign(nv,false);
+  apf::destroyNumbering(nums);
+}
 
-  if(size[idx1]>(gradingFactor*size[idx2])*(1+marginVal))
-  {
-    if(m->isOwned(edgAdjVert[idx1]))
-    {
-      size[idx1] = gradingFactor*size[idx2];
-      v_mag = apf::Vector3(size[idx1], size[idx1], size[idx1]);
-      apf::setVector(sizes,edgAdjVert[idx1],0,v_mag);
-      m->getAdjacent(edgAdjVert[idx1], 1, vertAdjEdg);
-      for (std::size_t i=0; i<vertAdjEdg.getSize();++i){
-        m->getIntTag(vertAdjEdg[i],isMarked,&marker[2]);
-        //if edge is not already marked
-        if(!marker[2]){
-          m->setIntTag(vertAdjEdg[i],isMarked,&marker[1]);
-          markedEdges.push(vertAdjEdg[i]);
-        }
+void markChanged(GradeGraph& g, int v)
+{
+  if(g.copyOffsets[v] == g.copyOffsets[v+1] || g.changed[v])
+    return;
+  g.changed[v] = true;
+  g.changedList.push_back(v);
+}
+
+//push every vertex that is smaller than a neighbor allows
+void seedGradation(GradeGraph& g, SizeHeap& heap, double gradingFactor)
+{
+  int nv = g.verts.size();
+  for (int v=0; v<nv; ++v){
+    double limit = gradingFactor*g.size[v];
+    for (int k=g.adjOffsets[v]; k<g.adjOffsets[v+1]; ++k){
+      if(g.size[g.adj[k]] > limit){
+        heap.push(SizedVertex(g.size[v],v));
+        break;
       }
-    } //end isOwned
-    else
-    { //Pack information to owning processor
-      needsParallel=1;
-      apf::Copies remotes;
-      m->getRemotes(edgAdjVert[idx1],remotes);
-      double newSize = gradingFactor*size[idx2];
-      int owningPart=m->getOwner(edgAdjVert[idx1]);
-      PCU_COMM_PACK(owningPart, remotes[owningPart]);
-      PCU_COMM_PACK(owningPart,newSize);
     }
   }
+}
 
-  return needsParallel;
+/* Dijkstra-style gradation: vertices leave the heap in increasing size
+   order, so a popped vertex is final for this round and only has to
+   limit its neighbors once. Shared vertices that got smaller are
+   collected for the boundary exchange. A nonzero maxPops returns
+   early so the caller can interleave communication. */
+void serialGradation(GradeGraph& g, SizeHeap& heap, double gradingFactor,
+    std::size_t maxPops = 0)
+{
+  std::size_t nPops = 0;
+  while(!heap.empty() && (!maxPops || nPops++ < maxPops)){
+    SizedVertex top = heap.top();
+    heap.pop();
+    int v = top.second;
+    //stale entry, v was reduced after it was pushed
+    if(top.first > g.size[v])
+      continue;
+    double limit = gradingFactor*top.first;
+    for (int k=g.adjOffsets[v]; k<g.adjOffsets[v+1]; ++k){
+      int u = g.adj[k];
+      if(g.size[u] > limit){
+        g.size[u] = limit;
+        heap.push(SizedVertex(limit,u));
+        markChanged(g,u);
+      }
+    }
+  }
 }
 
-void markEdgesInitial(apf::Mesh* m, std::queue<apf::MeshEntity*> &markedEdges,double gradingFactor)
+#ifdef _OPENMP
+//lower *addr to val; true if this thread made the change
+bool atomicMin(double* addr, double val)
 {
-  //marker structure for 0) not marked 1) marked 2)storage
-  int marker[3] = {0,1,0};
+  double cur;
+  __atomic_load(addr, &cur, __ATOMIC_RELAXED);
+  while(val < cur){
+    if(__atomic_compare_exchange(addr, &cur, &val, true,
+          __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return true;
+  }
+  return false;
+}
 
-  double size[2];
-  apf::Vector3 v_mag = apf::Vector3(0.0,0.0,0.0);
-  apf::MeshTag* isMarked = m->findTag("isMarked");
-  apf::Field* sizes = m->findField("sizes");
-  apf::Adjacent edgAdjVert;
-  apf::MeshEntity* edge;
-  apf::MeshIterator* it = m->begin(1);
-  while((edge=m->iterate(it))){
-    m->getAdjacent(edge, 0, edgAdjVert);
+/* Threaded on-part gradation. All threads relax the edges of the current
+   frontier at once with an atomic min on the dense sizes, and the
+   vertices that got smaller form the next frontier. Sizes only decrease
+   and every update is the grading factor times a neighbor size, so this
+   converges to the same fixed point as the heap-based sweep. */
+void threadedGradation(GradeGraph& g, SizeHeap& heap, double gradingFactor,
+    int threads)
+{
+  int nv = g.verts.size();
+  std::vector<char> inNext(nv,0);
+  std::vector<int> frontier;
+  while(!heap.empty()){
+    int v = heap.top().second;
+    heap.pop();
+    if(!inNext[v]){
+      inNext[v] = 1;
+      frontier.push_back(v);
+    }
+  }
+  std::fill(inNext.begin(), inNext.end(), 0);
 
-    for (std::size_t i=0; i < edgAdjVert.getSize(); ++i){
-      apf::getVector(sizes,edgAdjVert[i],0,v_mag);
-      size[i] = v_mag[0];
+  std::vector<int> next;
+  while(!frontier.empty()){
+    next.clear();
+    #pragma omp parallel num_threads(threads)
+    {
+      std::vector<int> localNext;
+      #pragma omp for schedule(dynamic,256)
+      for (int i=0; i<(int)frontier.size(); ++i){
+        int v = frontier[i];
+        double h;
+        __atomic_load(&(g.size[v]), &h, __ATOMIC_RELAXED);
+        double limit = gradingFactor*h;
+        for (int k=g.adjOffsets[v]; k<g.adjOffsets[v+1]; ++k){
+          int u = g.adj[k];
+          if(atomicMin(&(g.size[u]), limit) &&
+             !__atomic_exchange_n(&(inNext[u]), 1, __ATOMIC_RELAXED))
+            localNext.push_back(u);
+        }
+      }
+      #pragma omp critical
+      next.insert(next.end(), localNext.begin(), localNext.end());
     }
-    if( (size[0] > gradingFactor*size[1]) || (size[1] > gradingFactor*size[0]) ){
-      //add edge to a queue
-      markedEdges.push(edge);
-      //tag edge to indicate that it is part of queue
-      m->setIntTag(edge,isMarked,&marker[1]);
+    for (std::size_t i=0; i<next.size(); ++i){
+      inNext[next[i]] = 0;
+      markChanged(g,next[i]);
     }
-    else{
-      m->setIntTag(edge,isMarked,&marker[0]);
+    frontier.swap(next);
+  }
+}
+#endif
+
+//threaded only when asked for more than one thread per rank
+void localGradation(GradeGraph& g, SizeHeap& heap, double gradingFactor,
+    int threads)
+{
+#ifdef _OPENMP
+  if(threads > 1){
+    threadedGradation(g,heap,gradingFactor,threads);
+    return;
+  }
+#endif
+  serialGradation(g,heap,gradingFactor);
+}
+
+//smaller wins; the received vertex restarts the local sweep
+void receiveSize(GradeGraph& g, SizeHeap& heap, int v, double h)
+{
+  if(h < g.size[v]){
+    g.size[v] = h;
+    heap.push(SizedVertex(h,v));
+  }
+}
+
+//send the final sizes of changed boundary vertices to all their copies
+void exchangeBoundarySizes(GradeGraph& g, SizeHeap& heap)
+{
+  PCU_Comm_Begin();
+  for (std::size_t i=0; i<g.changedList.size(); ++i){
+    int v = g.changedList[i];
+    for (int k=g.copyOffsets[v]; k<g.copyOffsets[v+1]; ++k){
+      PCU_COMM_PACK(g.copyParts[k], g.copyIndices[k]);
+      PCU_COMM_PACK(g.copyParts[k], g.size[v]);
     }
+    g.changed[v] = false;
+  }
+  g.changedList.clear();
+  PCU_Comm_Send();
+  while(PCU_Comm_Receive()){
+    int v;
+    double h;
+    PCU_COMM_UNPACK(v);
+    PCU_COMM_UNPACK(h);
+    receiveSize(g,heap,v,h);
   }
-  m->end(it);
 }
 
-int serialGradation(apf::Mesh* m, std::queue<apf::MeshEntity*> &markedEdges,double gradingFactor)
+struct SizeMessage {
+  int index;
+  double size;
+};
+
+typedef std::map<int, std::vector<SizeMessage> > SizeOutbox;
+
+struct PendingSend {
+  std::vector<SizeMessage> buf;
+  MPI_Request req;
+};
+
+/* Asynchronous gradation. Parts exchange boundary sizes with their
+   neighbors point-to-point while the local heap is still being
+   processed. Completion is detected by counting messages: when a part
+   is idle it contributes its sent and received counts to a nonblocking
+   sum, and the loop ends once two consecutive sums report the same
+   number of sends and every send has been received. */
+void asyncGradation(GradeGraph& g, SizeHeap& heap, double gradingFactor)
 {
-  double size[2];
-  apf::Vector3 v_mag = apf::Vector3(0.0,0.0,0.0);
-  //marker structure for 0) not marked 1) marked 2)storage
-  int marker[3] = {0,1,0};
-  apf::MeshTag* isMarked = m->findTag("isMarked");
-  apf::Field* sizes = m->findField("sizes");
-  apf::Adjacent edgAdjVert;
-  apf::Adjacent vertAdjEdg;
-  apf::MeshEntity* edge;
-  apf::MeshIterator* it = m->begin(1);
-  int needsParallel=0;
-
-  //perform serial gradation while packing necessary info for parallel
-  while(!markedEdges.empty()){
-    edge = markedEdges.front();
-    m->getAdjacent(edge, 0, edgAdjVert);
-    for (std::size_t i=0; i < edgAdjVert.getSize(); ++i){
-      apf::getVector(sizes,edgAdjVert[i],0,v_mag);
-      size[i] = v_mag[0];
+  const int sizeTag = 7101;
+  const std::size_t popsPerPoll = 4096;
+  MPI_Comm comm;
+  MPI_Comm_dup(PCU_Get_Comm(), &comm);
+
+  SizeOutbox outbox;
+  std::list<PendingSend> pending;
+  long counts[2] = {0, 0}; //sent, received
+  long snapshot[2] = {0, 0}; //counts as of the pending sum
+  long totals[2] = {0, 0};
+  long lastSent = -1;
+  bool waveActive = false;
+  MPI_Request waveReq;
+  bool done = false;
+  while(!done){
+    serialGradation(g,heap,gradingFactor,popsPerPoll);
+
+    //a changed vertex is final once no pending pop can lower it
+    double finalBound = heap.empty() ? 0.0 : gradingFactor*heap.top().first;
+    std::size_t nKept = 0;
+    for (std::size_t i=0; i<g.changedList.size(); ++i){
+      int v = g.changedList[i];
+      if(!heap.empty() && g.size[v] > finalBound){
+        g.changedList[nKept++] = v;
+        continue;
+      }
+      for (int k=g.copyOffsets[v]; k<g.copyOffsets[v+1]; ++k){
+        SizeMessage msg = {g.copyIndices[k], g.size[v]};
+        outbox[g.copyParts[k]].push_back(msg);
+      }
+      g.changed[v] = false;
+    }
+    g.changedList.resize(nKept);
+    APF_ITERATE(SizeOutbox, outbox, oit){
+      if(oit->second.empty())
+        continue;
+      pending.push_back(PendingSend());
+      PendingSend& ps = pending.back();
+      ps.buf.swap(oit->second);
+      MPI_Isend(&(ps.buf[0]), ps.buf.size()*sizeof(SizeMessage), MPI_BYTE,
+          oit->first, sizeTag, comm, &(ps.req));
+      ++counts[0];
     }
 
-    needsParallel+=gradeSizeModify(m, gradingFactor, size, edgAdjVert,
-      vertAdjEdg, markedEdges, isMarked, 0);
-    needsParallel+=gradeSizeModify(m, gradingFactor, size, edgAdjVert,
-      vertAdjEdg, markedEdges, isMarked, 1);
+    //take whatever has arrived
+    bool received = false;
+    while(true){
+      int arrived;
+      MPI_Status status;
+      MPI_Iprobe(MPI_ANY_SOURCE, sizeTag, comm, &arrived, &status);
+      if(!arrived)
+        break;
+      int nbytes;
+      MPI_Get_count(&status, MPI_BYTE, &nbytes);
+      std::vector<SizeMessage> in(nbytes/sizeof(SizeMessage));
+      MPI_Recv(&(in[0]), nbytes, MPI_BYTE, status.MPI_SOURCE, sizeTag,
+          comm, MPI_STATUS_IGNORE);
+      ++counts[1];
+      received = true;
+      for (std::size_t i=0; i<in.size(); ++i)
+        receiveSize(g,heap,in[i].index,in[i].size);
+    }
 
-    m->setIntTag(edge,isMarked,&marker[0]);
-    markedEdges.pop();
+    std::list<PendingSend>::iterator pit = pending.begin();
+    while(pit != pending.end()){
+      int sent;
+      MPI_Test(&(pit->req), &sent, MPI_STATUS_IGNORE);
+      if(sent)
+        pit = pending.erase(pit);
+      else
+        ++pit;
+    }
+
+    if(!heap.empty() || received)
+      continue;
+    if(!waveActive){
+      //counts keeps changing while the sum is pending, so reduce a copy
+      snapshot[0] = counts[0];
+      snapshot[1] = counts[1];
+      MPI_Iallreduce(snapshot, totals, 2, MPI_LONG, MPI_SUM, comm, &waveReq);
+      waveActive = true;
+    }
+    else{
+      int waveDone;
+      MPI_Test(&waveReq, &waveDone, MPI_STATUS_IGNORE);
+      if(waveDone){
+        waveActive = false;
+        done = (totals[0] == totals[1] && totals[0] == lastSent);
+        lastSent = totals[0];
+      }
+    }
   }
-  return needsParallel;
+  APF_ITERATE(std::list<PendingSend>, pending, pit)
+    MPI_Wait(&(pit->req), MPI_STATUS_IGNORE);
+  MPI_Comm_free(&comm);
 }
 
-void addSmoother(apf::Mesh2* m, double gradingFactor) {
-  meshGradation(m, gradingFactor);
+void addSmoother(apf::Mesh2* m, double gradingFactor, bool async, int threads) {
+  meshGradation(m, gradingFactor, async, threads);
 }
 
-void meshGradation(apf::Mesh2* m, double gradingFactor)
+void meshGradation(apf::Mesh2* m, double gradingFactor, bool async, int threads)
 {
   if(!PCU_Comm_Self())
     std::cout<<"Starting grading\n";
-  apf::MeshEntity* edge;
-  apf::Adjacent edgAdjVert;
-  apf::Adjacent vertAdjEdg;
-  double size[2];
-  std::queue<apf::MeshEntity*> markedEdges;
-  apf::MeshTag* isMarked = m->createIntTag("isMarked",1);
   apf::Field* sizes = m->findField("sizes");
+  assert(sizes);
 
-  //marker structure for 0) not marked 1) marked 2)storage
-  int marker[3] = {0,1,0};
-
-  apf::MeshIterator* it;
-  markEdgesInitial(m,markedEdges,gradingFactor);
-
-  int needsParallel=1;
-  int nCount=1;
-  while(needsParallel)
-  {
-    PCU_Comm_Begin();
-    needsParallel = serialGradation(m,markedEdges,gradingFactor);
-
-    PCU_Add_Ints(&needsParallel,1);
-    if(!PCU_Comm_Self())
-      std::cerr<<"Sending size info for gradation"<<std::endl;
-    PCU_Comm_Send();
+  GradeGraph g;
+  buildGradeGraph(m,sizes,g);
+  SizeHeap heap;
+  seedGradation(g,heap,gradingFactor);
 
-    apf::MeshEntity* ent;
-    double receivedSize;
-    double currentSize;
-    double newSize;
-    apf::Vector3 v_mag = apf::Vector3(0.0,0.0,0.0);
-
-    //Need a container to get all entitites that need to be updated on remotes
-    std::queue<apf::MeshEntity*> updateRemoteVertices;
-
-    apf::Copies remotes;
-    //owning copies are receiving
-    while(PCU_Comm_Receive())
+  int nRounds=0;
+  if(async){
+    asyncGradation(g,heap,gradingFactor);
+  }
+  else{
+    while(true)
     {
-      PCU_COMM_UNPACK(ent);
-      PCU_COMM_UNPACK(receivedSize);
-
-      if(!m->isOwned(ent)){
-        std::cout<<"THERE WAS AN ERROR"<<std::endl;
-        std::exit(1);
-      }
-
-      apf::getVector(sizes,ent,0,v_mag);
-      currentSize = v_mag[0];
-      newSize = std::min(receivedSize,currentSize);
-      v_mag = apf::Vector3(newSize, newSize, newSize);
-      apf::setVector(sizes,ent,0,v_mag);
-
-      //add adjacent edges into Q
-      m->getAdjacent(ent, 1, vertAdjEdg);
-      for (std::size_t i=0; i<vertAdjEdg.getSize();++i)
-      {
-        edge = vertAdjEdg[i];
-        m->getIntTag(vertAdjEdg[i],isMarked,&marker[2]);
-        if(!marker[2]) {
-          markedEdges.push(edge);
-          //tag edge to indicate that it is part of queue
-          m->setIntTag(edge,isMarked,&marker[1]);
-        }
-      }
-      updateRemoteVertices.push(ent);
+      localGradation(g,heap,gradingFactor,threads);
+      ++nRounds;
+      int needsParallel = g.changedList.size();
+      PCU_Add_Ints(&needsParallel,1);
+      if(!needsParallel)
+        break;
+      exchangeBoundarySizes(g,heap);
     }
+  }
 
-    PCU_Comm_Begin();
+  for (std::size_t i=0; i<g.verts.size(); ++i)
+    setIsoSize(sizes,g.verts[i],g.size[i]);
+  apf::synchronize(sizes);
 
-    while(!updateRemoteVertices.empty())
-    {
-      ent = updateRemoteVertices.front();
-      //get remote copies and send updated mesh sizes
-      m->getRemotes(ent,remotes);
-      for(apf::Copies::iterator iter=remotes.begin(); iter!=remotes.end();++iter)
-      {
-        PCU_COMM_PACK(iter->first, iter->second);
-      }
-      updateRemoteVertices.pop();
-    }
-
-    PCU_Comm_Send();
-    //while remote copies are receiving
-    while(PCU_Comm_Receive())
-    {
-      //unpack
-      PCU_COMM_UNPACK(ent);
-      //PCU_COMM_UNPACK(receivedSize);
-      assert(!m->isOwned(ent));
-
-      if(m->isOwned(ent)){
-        std::cout<<"Problem occurred\n";
-        std::exit(1);
-      }
+  if(!PCU_Comm_Self()){
+    if(async)
+      std::cout<<"Completed asynchronous grading\n";
+    else
+      std::cout<<"Completed grading in "<<nRounds<<" rounds\n";
+  }
+}
 
-      //add adjacent edges into Q
-      m->getAdjacent(ent, 1, vertAdjEdg);
-      for (std::size_t i=0; i<vertAdjEdg.getSize();++i)
-      {
-        edge = vertAdjEdg[i];
-        m->getIntTag(vertAdjEdg[i],isMarked,&marker[2]);
-        if(!marker[2]) {
-          markedEdges.push(edge);
-          //tag edge to indicate that it is part of queue
-          m->setIntTag(edge,isMarked,&marker[1]);
-        }
-      }
+/* Jacobi smoothing of the mesh motion. Vertices classified on model
+   regions move by the edge-length weighted average displacement of
+   their neighbors, everything on the model boundary keeps its
+   prescribed motion. Each part only sums over the edges it owns and
+   the partial sums of shared vertices are added up by apf::accumulate,
+   so all copies of a vertex get the same average. */
+void smoothMeshMotion(apf::Mesh2* m, apf::Field* motion, int iterations,
+    int threads)
+{
+  if(iterations <= 0)
+    return;
+  int dim = m->getDimension();
+  apf::Numbering* nums = apf::numberOverlapDimension(m, "smooth_vtx", 0);
+  int nv = m->count(0);
+  std::vector<apf::MeshEntity*> verts(nv);
+  std::vector<double> x(3*nv);
+  std::vector<double> disp(3*nv);
+  std::vector<char> isFree(nv);
+  std::vector<int> shared;
+  apf::Vector3 p;
+  double newx[3];
+  apf::MeshEntity* v;
+  apf::MeshIterator* it = m->begin(0);
+  while((v=m->iterate(it))){
+    int i = apf::getNumber(nums,v,0,0);
+    verts[i] = v;
+    m->getPoint(v,0,p);
+    apf::getComponents(motion,v,0,newx);
+    for (int j=0; j<3; ++j){
+      x[3*i+j] = p[j];
+      disp[3*i+j] = newx[j]-p[j];
     }
-    apf::synchronize(sizes);
-
-  } //end outer while
+    isFree[i] = (m->getModelType(m->toModel(v)) == dim);
+    if(m->isShared(v))
+      shared.push_back(i);
+  }
+  m->end(it);
 
-  //Cleanup of edge marker field
+  //rows of the owned edges, weighted by inverse length
+  std::vector<int> edgeVerts;
+  std::vector<double> edgeWeights;
+  std::vector<int> offsets(nv+1,0);
+  apf::MeshEntity* edge;
+  apf::MeshEntity* ev[2];
   it = m->begin(1);
   while((edge=m->iterate(it))){
-    m->removeTag(edge,isMarked);
+    if(!m->isOwned(edge))
+      continue;
+    m->getDownward(edge, 0, ev);
+    int a = apf::getNumber(nums,ev[0],0,0);
+    int b = apf::getNumber(nums,ev[1],0,0);
+    double len = 0.0;
+    for (int j=0; j<3; ++j)
+      len += (x[3*a+j]-x[3*b+j])*(x[3*a+j]-x[3*b+j]);
+    edgeVerts.push_back(a);
+    edgeVerts.push_back(b);
+    edgeWeights.push_back(1.0/sqrt(len));
+    ++offsets[a+1];
+    ++offsets[b+1];
   }
   m->end(it);
-  m->destroyTag(isMarked);
+  for (int i=0; i<nv; ++i)
+    offsets[i+1] += offsets[i];
+  std::vector<int> adj(offsets[nv]);
+  std::vector<double> weights(offsets[nv]);
+  std::vector<int> fill(offsets.begin(), offsets.end()-1);
+  for (std::size_t e=0; e<edgeWeights.size(); ++e){
+    int a = edgeVerts[2*e];
+    int b = edgeVerts[2*e+1];
+    adj[fill[a]] = b;
+    weights[fill[a]++] = edgeWeights[e];
+    adj[fill[b]] = a;
+    weights[fill[b]++] = edgeWeights[e];
+  }
 
+  //weighted displacement sum and total weight of each vertex
+  std::vector<double> sums(4*nv);
+  apf::Field* halo = apf::createPackedField(m, "smooth_sums", 4);
+  for (int iter=0; iter<iterations; ++iter){
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(threads)
+#endif
+    for (int i=0; i<nv; ++i){
+      double* s = &sums[4*i];
+      s[0] = s[1] = s[2] = s[3] = 0.0;
+      for (int k=offsets[i]; k<offsets[i+1]; ++k){
+        int u = adj[k];
+        for (int j=0; j<3; ++j)
+          s[j] += weights[k]*disp[3*u+j];
+        s[3] += weights[k];
+      }
+    }
+    for (std::size_t k=0; k<shared.size(); ++k)
+      apf::setComponents(halo, verts[shared[k]], 0, &sums[4*shared[k]]);
+    apf::accumulate(halo);
+    for (std::size_t k=0; k<shared.size(); ++k)
+      apf::getComponents(halo, verts[shared[k]], 0, &sums[4*shared[k]]);
+#ifdef _OPENMP
+    #pragma omp parallel for schedule(static) num_threads(threads)
+#endif
+    for (int i=0; i<nv; ++i){
+      if(!isFree[i] || sums[4*i+3] <= 0.0)
+        continue;
+      for (int j=0; j<3; ++j)
+        disp[3*i+j] = sums[4*i+j]/sums[4*i+3];
+    }
+  }
+  apf::destroyField(halo);
+
+  for (int i=0; i<nv; ++i){
+    if(!isFree[i])
+      continue;
+    for (int j=0; j<3; ++j)
+      newx[j] = x[3*i+j]+disp[3*i+j];
+    apf::setComponents(motion, verts[i], 0, newx);
+  }
+  apf::destroyNumbering(nums);
   if(!PCU_Comm_Self())
-    std::cout<<"Completed grading\n";
+    std::cout<<"Smoothed mesh motion in "<<iterations<<" iterations\n";
 }
 
 } // end namespace pc
@@ -10,9 +10,20 @@
 
 namespace pc {
 
-  void addSmoother(apf::Mesh2* m, double gradingFactor);
+  void addSmoother(apf::Mesh2* m, double gradingFactor, bool async = false,
+                   int threads = 1);
 
-  void meshGradation(apf::Mesh2* m, double gradingFactor);
+  /* async: exchange boundary sizes point-to-point while grading,
+     without a collective per round. threads > 1 grades each part with
+     that many OpenMP threads (bulk synchronous mode only) */
+  void meshGradation(apf::Mesh2* m, double gradingFactor, bool async = false,
+                     int threads = 1);
+
+  /* relax the interior of the vertex motion field (new coordinates) with
+     the given number of Jacobi sweeps, on that many OpenMP threads per
+     rank; boundary motion stays */
+  void smoothMeshMotion(apf::Mesh2* m, apf::Field* motion, int iterations,
+                        int threads = 1);
 
 }
 
@@ -1,87 +1,164 @@
 #include "pcUpdateMesh.h"
 #include <PCU.h>
 #include <cassert>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <algorithm>
 
 namespace pc {
-  /* ideally, this comes from some input file */
-  meshMotion getTDMeshMotion(int caseId, int step) {
-    double offset, disp, rang, sfct;
-    offset = 0.0;
-    disp = 2e-4 + 2e-5;
-    rang = 2.0;
-    sfct = 0.9;
-    if (caseId == 1) {
-      offset = 2e-4 * (double)(step - 1) + 2e-5;
-      printf("current step is %d; offset = %f\n",step,offset);
+
+  /* one line of a motion schedule file */
+  struct MotionRow {
+    int tag;
+    int step;
+    double trans[3];
+    double rotaxis[3];
+    double rotpt[3];
+    double rotang;
+    double scale;
+    bool operator<(const MotionRow& o) const {
+      return tag < o.tag || (tag == o.tag && step < o.step);
     }
-    else if (caseId == 2) {
-      offset = 4e-4;
+  };
+
+  /* schedule files list, per model region tag, the motion of every step
+     from a start step until that tag's next row:
+
+       # tag step  tx ty tz  ax ay az  px py pz  angle scale
+       1339  0     2.2e-4 0 0  0 0 1  5e-4 1.125e-3 0  2.0 0.9
+
+     the rotation point is where it sits at the start step and then
+     travels with the translation of the body */
+  static bool readMotionRows(const char* filename, std::vector<MotionRow>& rows) {
+    std::ifstream in(filename);
+    if (!in)
+      return false;
+    std::string line;
+    while (std::getline(in, line)) {
+      std::size_t hash = line.find('#');
+      if (hash != std::string::npos)
+        line.erase(hash);
+      std::istringstream ss(line);
+      MotionRow r;
+      if (!(ss >> r.tag))
+        continue;
+      ss >> r.step;
+      for (int i = 0; i < 3; i++) ss >> r.trans[i];
+      for (int i = 0; i < 3; i++) ss >> r.rotaxis[i];
+      for (int i = 0; i < 3; i++) ss >> r.rotpt[i];
+      ss >> r.rotang >> r.scale;
+      if (!ss || r.step < 0)
+        return false;
+      rows.push_back(r);
     }
-    else {
-      printf("wrong case id\n");
-      assert(0);
+    return true;
+  }
+
+  MotionSchedule* loadMotionSchedule(const char* filename, int numSteps, int firstStep) {
+    std::vector<MotionRow> rows;
+    if (!readMotionRows(filename, rows) || rows.empty()) {
+      if(!PCU_Comm_Self())
+        fprintf(stderr, "cannot read motion schedule %s\n", filename);
+      return 0;
     }
+    std::sort(rows.begin(), rows.end());
+
+    MotionSchedule* ms = new MotionSchedule();
+    ms->numSteps = numSteps;
+    ms->lastStep = firstStep;
+    std::size_t first = 0;
+    while (first < rows.size()) {
+      std::size_t end = first;
+      while (end < rows.size() && rows[end].tag == rows[first].tag)
+        ++end;
+      MotionSchedule::Body b;
+      b.tag = rows[first].tag;
+      b.trans.assign(3 * (numSteps + 1), 0.0);
+      b.angle.assign(numSteps + 1, 0.0);
+      b.point.resize(3 * (numSteps + 1));
+      b.axis.resize(3 * (numSteps + 1));
+      b.scale.resize(numSteps + 1);
+      // trans and angle at s sum the motion of steps 0 to s-1; a body
+      // stays put before its first row
+      int active = -1;
+      std::size_t next = first;
+      for (int s = 0; s <= numSteps; s++) {
+        if (s > 0) {
+          for (int i = 0; i < 3; i++)
+            b.trans[3 * s + i] = b.trans[3 * (s - 1) + i];
+          b.angle[s] = b.angle[s - 1];
+          if (active >= 0) {
+            for (int i = 0; i < 3; i++)
+              b.trans[3 * s + i] += rows[active].trans[i];
+            b.angle[s] += rows[active].rotang;
+          }
+        }
+        while (next < end && rows[next].step <= s)
+          active = next++;
+        MotionRow const& r = rows[active >= 0 ? active : first];
+        for (int i = 0; i < 3; i++) {
+          b.axis[3 * s + i] = r.rotaxis[i];
+          b.point[3 * s + i] = r.rotpt[i];
+          // the point given at the row start travels with the body
+          if (active >= 0)
+            b.point[3 * s + i] += b.trans[3 * s + i] - b.trans[3 * r.step + i];
+        }
+        b.scale[s] = r.scale;
+      }
+      ms->bodies.push_back(b);
+      first = end;
+    }
+    if(!PCU_Comm_Self())
+      printf("loaded motion schedule %s: %d bodies over %d steps\n",
+             filename, (int)ms->bodies.size(), numSteps);
+    return ms;
+  }
+
+  void destroyMotionSchedule(MotionSchedule* ms) {
+    delete ms;
+  }
+
+  meshMotion getScheduledMotion(MotionSchedule const& ms, int step, int stride) {
+    assert(step >= 0 && stride >= 0);
+    int from = std::min(step, ms.numSteps);
+    int to = std::min(step + stride, ms.numSteps);
     meshMotion mm;
-    rigidBodyMotion mbm;
-    mm.parSurFaces.push_back(54);
-    mm.parSurFaces.push_back(46);
-    mm.parSurFaces.push_back(41);
-    mm.parSurRegions.push_back(1);
-// grain11
-    mbm = rigidBodyMotion(1339, rang, sfct);
-    mbm.set_trans(disp, 0.0, 0.0);
-    mbm.set_rotaxis(0.0, 0.0, 1.0);
-    mbm.set_rotpt(0.5e-3 + offset, 1.125e-3, 0.0);
-    mm.rigidBodyMotions.push_back(mbm);
-// grain12
-    mbm = rigidBodyMotion(1036, rang, sfct);
-    mbm.set_trans(disp, 0.0, 0.0);
-    mbm.set_rotaxis(0.0, 0.0, 1.0);
-    mbm.set_rotpt(2.625e-3 + offset, 1.125e-3, 0.0);
-    mm.rigidBodyMotions.push_back(mbm);
-// grain13
-    mbm = rigidBodyMotion(733, rang, sfct);
-    mbm.set_trans(disp, 0.0, 0.0);
-    mbm.set_rotaxis(0.0, 0.0, 1.0);
-    mbm.set_rotpt(4.75e-3 + offset, 1.125e-3, 0.0);
-    mm.rigidBodyMotions.push_back(mbm);
-// grain21
-    mbm = rigidBodyMotion(1440, 0.0, sfct);
-    mbm.set_trans(disp, 0.0, 0.0);
-    mbm.set_rotaxis(0.0, 0.0, 1.0);
-    mbm.set_rotpt(0.5e-3 + offset, 0.0, 0.0);
-    mm.rigidBodyMotions.push_back(mbm);
-// grain22
-    mbm = rigidBodyMotion(1137, 0.0, sfct);
-    mbm.set_trans(disp, 0.0, 0.0);
-    mbm.set_rotaxis(0.0, 0.0, 1.0);
-    mbm.set_rotpt(2.625e-3 + offset, 0.0, 0.0);
-    mm.rigidBodyMotions.push_back(mbm);
-// grain23
-    mbm = rigidBodyMotion(834, 0.0, sfct);
-    mbm.set_trans(disp, 0.0, 0.0);
-    mbm.set_rotaxis(0.0, 0.0, 1.0);
-    mbm.set_rotpt(4.75e-3 + offset, 0.0, 0.0);
-    mm.rigidBodyMotions.push_back(mbm);
-// grain31
-    mbm = rigidBodyMotion(1238, rang, sfct);
-    mbm.set_trans(disp, 0.0, 0.0);
-    mbm.set_rotaxis(0.0, 0.0, -1.0);
-    mbm.set_rotpt(0.5e-3 + offset, -1.125e-3, 0.0);
-    mm.rigidBodyMotions.push_back(mbm);
-// grain32
-    mbm = rigidBodyMotion(935, rang, sfct);
-    mbm.set_trans(disp, 0.0, 0.0);
-    mbm.set_rotaxis(0.0, 0.0, -1.0);
-    mbm.set_rotpt(2.625e-3 + offset, -1.125e-3, 0.0);
-    mm.rigidBodyMotions.push_back(mbm);
-// grain33
-    mbm = rigidBodyMotion(632, rang, sfct);
-    mbm.set_trans(disp, 0.0, 0.0);
-    mbm.set_rotaxis(0.0, 0.0, -1.0);
-    mbm.set_rotpt(4.75e-3 + offset, -1.125e-3, 0.0);
-    mm.rigidBodyMotions.push_back(mbm);
-// return
+    mm.caseId = 0;
+    for (std::size_t i = 0; i < ms.bodies.size(); i++) {
+      MotionSchedule::Body const& b = ms.bodies[i];
+      double angle = b.angle[to] - b.angle[from];
+      // rotations about a point riding on the body add up as long as
+      // the axis does not change within the stride
+      for (int s = from + 1; angle != 0.0 && s < to; s++)
+        for (int k = 0; k < 3; k++)
+          if (b.axis[3 * s + k] != b.axis[3 * from + k]) {
+            if(!PCU_Comm_Self())
+              fprintf(stderr, "rotation axis of tag %d changes between steps"
+                              " %d and %d\n", b.tag, from, to);
+            assert(0);
+          }
+      // step s scales by scale[s], so a stride scales by their product;
+      // like the axis, the factor may not change within the stride
+      double scale = 1.0;
+      for (int s = from; s < to; s++) {
+        if (b.scale[s] != b.scale[from]) {
+          if(!PCU_Comm_Self())
+            fprintf(stderr, "scale of tag %d changes between steps"
+                            " %d and %d\n", b.tag, from, to);
+          assert(0);
+        }
+        scale *= b.scale[s];
+      }
+      rigidBodyMotion rbm(b.tag, angle, scale);
+      rbm.set_trans(b.trans[3 * to] - b.trans[3 * from],
+                    b.trans[3 * to + 1] - b.trans[3 * from + 1],
+                    b.trans[3 * to + 2] - b.trans[3 * from + 2]);
+      rbm.set_rotaxis(b.axis[3 * from], b.axis[3 * from + 1], b.axis[3 * from + 2]);
+      rbm.set_rotpt(b.point[3 * from], b.point[3 * from + 1], b.point[3 * from + 2]);
+      mm.rigidBodyMotions.push_back(rbm);
+    }
     return mm;
   }
 
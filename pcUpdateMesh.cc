@@ -2,6 +2,10 @@
 #include "pcAdapter.h"
 #include "pcSmooth.h"
 #include "pcWriteFiles.h"
+#include "pcProjection.h"
+#include "pcQuality.h"
+#include "pcInput.h"
+#include "pcBalance.h"
 #include <SimPartitionedMesh.h>
 #include "SimAdvMeshing.h"
 #include "SimModel.h"
@@ -20,6 +24,9 @@
 #include <string.h>
 #include <cassert>
 #include <cstdio>
+#include <cmath>
+#include <map>
+#include <algorithm>
 
 extern void MSA_setBLSnapping(pMSAdapt, int onoff);
 
@@ -30,6 +37,9 @@ namespace pc {
     assert(f);
     double* vals = new double[apf::countComponents(f)];
     assert(apf::countComponents(f) == 3);
+    phSolver::Input inp("solver.inp", "input.config");
+    pc::smoothMeshMotion(m, f, getOptionalInt(inp, "Mesh Smoothing Iterations", 0),
+                         getOptionalInt(inp, "Mesh Smoothing Threads", 1));
     apf::MeshEntity* vtx;
     apf::Vector3 points;
     apf::MeshIterator* itr = m->begin(0);
@@ -94,124 +104,33 @@ namespace pc {
 
 // temporarily used to write serial moved mesh and model
 // it also writes coordinates to file
-  bool updateAndWriteSIMDiscreteCoord(apf::Mesh2* m) {
+  bool updateAndWriteSIMDiscreteCoord(apf::Mesh2* m, bool writeSerial) {
     pProgress progress = Progress_new();
     Progress_setDefaultCallback(progress);
 
     apf::MeshSIM* apf_msim = dynamic_cast<apf::MeshSIM*>(m);
-    gmi_model* gmiModel = apf_msim->getModel();
-    pGModel model = gmi_export_sim(gmiModel);
     pParMesh ppm = apf_msim->getMesh();
 
     PM_write(ppm, "before_mover_parallel.sms", progress);
 
-    // declaration
-    pGRegion modelRegion;
-    VIter vIter;
-    pVertex meshVertex;
-    double disp[3];
-    double xyz[3];
-    double newpt[3];
-
-    pMesh pm = M_createFromParMesh(ppm,3,progress);
-//    M_release(ppm);
-    if (pm)
-      M_write(pm, "before_mover_serial.sms", 0, progress);
-
-    FILE* sFile;
-    int id;
-if (pm) {
-    // open file for writing displacements
-    sFile = fopen ("allrank_id_disp.dat", "w");
-
+    // write id and displacement of every vertex in parallel
     apf::Field* f = m->findField("motion_coords");
     assert(f);
-    double* vals = new double[apf::countComponents(f)];
-    assert(apf::countComponents(f) == 3);
-
-    // write id and displacement to file
-    id = 0;
-    vIter = M_vertexIter(pm);
-    while((meshVertex = VIter_next(vIter))){
-      apf::MeshEntity* vtx = reinterpret_cast<apf::MeshEntity*>(meshVertex);
-      apf::getComponents(f, vtx, 0, vals);
-      V_coord(meshVertex, xyz);
-      disp[0] = vals[0] - xyz[0];
-      disp[1] = vals[1] - xyz[1];
-      disp[2] = vals[2] - xyz[2];
-
-      fprintf(sFile, "%010d ", id);
-      for(int ii = 0; ii < 3; ii++) {
-        fprintf(sFile, " %f", disp[ii]);
-      }
-      fprintf(sFile, "\n");
-
-      id++;
+    if (!pc::writeDisplacements(m, f, "allrank_id_disp.bin")) {
+      Progress_delete(progress);
+      return false;
     }
-    VIter_delete(vIter);
-    delete [] vals;
-
-    // close file
-    fclose (sFile);
 
     // write serial mesh and model
-    if(!PCU_Comm_Self())
-      printf("write discrete model and serial mesh\n");
-    GM_write(M_model(pm), "discreteModel_serial.smd", 0, progress);
-    M_write(pm, "mesh_serial.sms", 0, progress);
-/*
-    // load serial mesh and displacement
-    pDiscreteModel dmodel = (pDiscreteModel) GM_load("discreteModel_serial.smd", 0, progress);
-    pMesh mesh = M_load("mesh_serial.sms", dmodel, progress);
-    sFile = fopen("allrank_id_disp.dat", "r");
-
-    if(!PCU_Comm_Self())
-      printf("start mesh mover on the serial mesh\n");
-    pMeshMover mmover = MeshMover_new(mesh, 0);
-
-    // mesh motion of vertices in region
-    int counter = 0;
-    vIter = M_vertexIter(mesh);
-    while((meshVertex = VIter_next(vIter))){
-
-      fscanf(sFile, "%010d", &id);
-      assert(counter == id);
-      for (int i = 0; i < 3; i++)
-        fscanf(sFile, "%lf", &disp[i]);
-      counter++;
-
-      V_coord(meshVertex, xyz);
-      newpt[0] = xyz[0] + disp[0];
-      newpt[1] = xyz[1] + disp[1];
-      newpt[2] = xyz[2] + disp[2];
-
-      pPList closureRegion = GEN_regions(EN_whatIn(meshVertex));
-      assert(PList_size(closureRegion));
-      modelRegion = (pGRegion) PList_item(closureRegion, 0);
-      assert(GEN_isDiscreteEntity(modelRegion));
-      MeshMover_setDiscreteDeformMove(mmover,modelRegion,meshVertex,newpt);
-      PList_delete(closureRegion);
+    if (writeSerial) {
+      pMesh pm = M_createFromParMesh(ppm,3,progress);
+      if (pm) {
+        if(!PCU_Comm_Self())
+          printf("write discrete model and serial mesh\n");
+        GM_write(M_model(pm), "discreteModel_serial.smd", 0, progress);
+        M_write(pm, "mesh_serial.sms", 0, progress);
+      }
     }
-    VIter_delete(vIter);
-
-    // close file
-    fclose (sFile);
-
-    // do real work
-    if(!PCU_Comm_Self())
-      printf("do real mesh mover\n");
-    int isRunMover = MeshMover_run(mmover, progress);
-    assert(isRunMover);
-    MeshMover_delete(mmover);
-
-    // write model and mesh
-    if(!PCU_Comm_Self())
-      printf("write updated discrete model and serial mesh\n");
-    GM_write(M_model(pm), "updated_model.smd", 0, progress);
-    M_write(pm, "after_mover_serial.sms", 0, progress);
-    exit(0);
-*/
-}
     PCU_Barrier();
     Progress_delete(progress);
     return true;
@@ -427,16 +346,109 @@ if (pm) {
   }
 // hardcoding }
 
-// check if a model entity is (on) a rigid body
-  int isOnRigidBody(pGModel model, pGEntity modelEnt, std::vector<ph::rigidBodyMotion> rbms) {
+// model entity to rigid body and to discrete regions whose closure holds it;
+// built once per model and body list, since closure queries are costly
+  struct MoverModelMap {
+    pGModel model;
+    std::vector<int> tags;
+    std::map<pGEntity, int> bodyOf;
+    std::map<pGEntity, std::vector<pGRegion> > discreteRegionsOf;
+  };
+
+  static MoverModelMap moverModelMap;
+
+  // region, faces, edges and vertices of a model region; shared
+  // entities show up more than once
+  void getRegionClosure(pGRegion r, std::vector<pGEntity>& closure) {
+    closure.clear();
+    closure.push_back(r);
+    pPList faces = GR_faces(r);
+    for(int i = 0; i < PList_size(faces); i++) {
+      pGFace face = (pGFace)PList_item(faces, i);
+      closure.push_back(face);
+      pPList edges = GF_edges(face);
+      for(int j = 0; j < PList_size(edges); j++) {
+        pGEdge edge = (pGEdge)PList_item(edges, j);
+        closure.push_back(edge);
+        for(int k = 0; k < 2; k++)
+          if (GE_vertex(edge, k))
+            closure.push_back(GE_vertex(edge, k));
+      }
+      PList_delete(edges);
+    }
+    PList_delete(faces);
+  }
+
+  void buildMoverModelMap(pGModel model, std::vector<ph::rigidBodyMotion> const& rbms) {
+    std::vector<int> tags(rbms.size());
     for(unsigned id = 0; id < rbms.size(); id++)
-      if(GEN_inClosure(GM_entityByTag(model, 3, rbms[id].tag), modelEnt)) return (int)id;
+      tags[id] = rbms[id].tag;
+    if (moverModelMap.model == model && moverModelMap.tags == tags)
+      return;
+    moverModelMap.model = model;
+    moverModelMap.tags = tags;
+    moverModelMap.bodyOf.clear();
+    moverModelMap.discreteRegionsOf.clear();
+    std::vector<pGEntity> closure;
+    for(unsigned id = 0; id < rbms.size(); id++) {
+      getRegionClosure((pGRegion)GM_entityByTag(model, 3, rbms[id].tag), closure);
+      // the first body containing an entity owns it
+      for(size_t i = 0; i < closure.size(); i++)
+        moverModelMap.bodyOf.insert(std::make_pair(closure[i], (int)id));
+    }
+    pGRegion modelRegion;
+    GRIter grIter = GM_regionIter(model);
+    while((modelRegion=GRIter_next(grIter))){
+      if (!GEN_isDiscreteEntity(modelRegion))
+        continue;
+      getRegionClosure(modelRegion, closure);
+      for(size_t i = 0; i < closure.size(); i++) {
+        std::vector<pGRegion>& rs = moverModelMap.discreteRegionsOf[closure[i]];
+        if (rs.empty() || rs.back() != modelRegion)
+          rs.push_back(modelRegion);
+      }
+    }
+    GRIter_delete(grIter);
+  }
+
+  static MotionSchedule* motionSchedule = 0;
+
+  void setMotionSchedule(MotionSchedule* ms) {
+    motionSchedule = ms;
+  }
+
+// rigid body motions of the scheduled steps since the last move
+  void getScheduledRigidBodyMotions(int step, std::vector<ph::rigidBodyMotion>& rbms) {
+    int stride = std::max(step - motionSchedule->lastStep, 0);
+    meshMotion mm = getScheduledMotion(*motionSchedule, motionSchedule->lastStep, stride);
+    motionSchedule->lastStep = step;
+    rbms.clear();
+    std::list<rigidBodyMotion>::const_iterator it;
+    for (it = mm.rigidBodyMotions.begin(); it != mm.rigidBodyMotions.end(); ++it) {
+      ph::rigidBodyMotion rbm;
+      rbm.tag = it->tag;
+      for (int i = 0; i < 3; i++) {
+        rbm.trans[i] = it->trans[i];
+        rbm.rotaxis[i] = it->rotaxis[i];
+        rbm.rotpt[i] = it->rotpt[i];
+      }
+      rbm.rotang = it->rotang;
+      rbm.scale = it->scale;
+      rbms.push_back(rbm);
+    }
+  }
+
+// check if a model entity is (on) a rigid body
+  int isOnRigidBody(pGEntity modelEnt) {
+    std::map<pGEntity, int>::const_iterator it = moverModelMap.bodyOf.find(modelEnt);
+    if (it != moverModelMap.bodyOf.end()) return it->second;
     // not find
     return -1;
   }
 
 // auto detect non-rigid body model entities
-  bool updateSIMCoordAuto(ph::Input& in, apf::Mesh2* m, int cooperation) {
+  bool updateSIMCoordAuto(ph::Input& in, apf::Mesh2* m, int cooperation,
+                          apf::Field* keep) {
     if (in.writeSimLog)
       Sim_logOn("updateSIMCoord.log");
 
@@ -457,10 +469,6 @@ if (pm) {
 
     // declaration
     pGRegion modelRegion;
-    pGFace modelFace;
-    pGEdge modelEdge;
-    pGVertex modelVertex;
-    VIter vIter;
     pVertex meshVertex;
     double newpt[3];
     double newpar[2];
@@ -472,148 +480,98 @@ if (pm) {
     pMeshMover mmover = MeshMover_new(ppm, 0);
 
     std::vector<ph::rigidBodyMotion> rbms;
-    if (in.nRigidBody > 0) {
+    if (motionSchedule) {
+      getScheduledRigidBodyMotions(in.timeStepNumber, rbms);
+    }
+    else if (in.nRigidBody > 0) {
       core_get_rbms(rbms);
     }
     else {
       rbms.clear();
     }
-    // loop over model regions
+    buildMoverModelMap(model, rbms);
+    // rigid body motions are set per model region
     GRIter grIter = GM_regionIter(model);
     while((modelRegion=GRIter_next(grIter))){
-      int id = isOnRigidBody(model, modelRegion, rbms);
+      int id = isOnRigidBody(modelRegion);
       if(id >= 0) {
         assert(!GEN_isDiscreteEntity(modelRegion)); // should be parametric geometry
-/*
-        printf("set rigid body motion: region %d; disp = (%e,%e,%e); rotaxis = (%e,%e,%e); rotpt = (%e,%e,%e); rotang = %f; scale = %f\n",
-                GEN_tag(modelRegion), rbms[id].trans[0], rbms[id].trans[1], rbms[id].trans[2],
-                rbms[id].rotaxis[0], rbms[id].rotaxis[1], rbms[id].rotaxis[2],
-                rbms[id].rotpt[0], rbms[id].rotpt[1], rbms[id].rotpt[2],
-                rbms[id].rotang, rbms[id].scale);
-*/
         MeshMover_setTransform(mmover, modelRegion, rbms[id].trans, rbms[id].rotaxis,
                                    rbms[id].rotpt, rbms[id].rotang, rbms[id].scale);
       }
-      else {
-        if (!GEN_isDiscreteEntity(modelRegion)) { // parametric
-          vIter = M_classifiedVertexIter(pm, modelRegion, 0);
-          while((meshVertex = VIter_next(vIter))){
-            apf::MeshEntity* vtx = reinterpret_cast<apf::MeshEntity*>(meshVertex);
-            apf::getComponents(f, vtx, 0, &vals[0]);
-            const double newloc[3] = {vals[0], vals[1], vals[2]};
-            MeshMover_setVolumeMove(mmover,meshVertex,newloc);
-          }
-          VIter_delete(vIter);
-        }
-        else { // discrete
-          vIter = M_classifiedVertexIter(pm, modelRegion, 1);
-          while((meshVertex = VIter_next(vIter))){
-            apf::MeshEntity* vtx = reinterpret_cast<apf::MeshEntity*>(meshVertex);
-            apf::getComponents(f, vtx, 0, &vals[0]);
-            const double newloc[3] = {vals[0], vals[1], vals[2]};
-            MeshMover_setDiscreteDeformMove(mmover,modelRegion,meshVertex,newloc);
-          }
-          VIter_delete(vIter);
-        }
-      }
     }
     GRIter_delete(grIter);
 
-    // loop over model surfaces
-    GFIter gfIter = GM_faceIter(model);
-    while((modelFace=GFIter_next(gfIter))){
-      int id = isOnRigidBody(model, modelFace, rbms);
-      if(id >= 0) {
-        assert(!GEN_isDiscreteEntity(modelFace)); // should be parametric geometry
+    // everything else in one sweep over the mesh vertices
+    std::map<pGEntity, std::vector<pGRegion> >::const_iterator dit;
+    VIter vIter = M_vertexIter(pm);
+    while((meshVertex = VIter_next(vIter))){
+      apf::MeshEntity* vtx = reinterpret_cast<apf::MeshEntity*>(meshVertex);
+      apf::getComponents(f, vtx, 0, &vals[0]);
+      const double newloc[3] = {vals[0], vals[1], vals[2]};
+      pGEntity modelEnt = V_whatIn(meshVertex);
+      // discrete regions move every vertex in their closure
+      dit = moverModelMap.discreteRegionsOf.find(modelEnt);
+      if (dit != moverModelMap.discreteRegionsOf.end())
+        for(size_t i = 0; i < dit->second.size(); i++)
+          MeshMover_setDiscreteDeformMove(mmover,dit->second[i],meshVertex,newloc);
+      if (GEN_isDiscreteEntity(modelEnt))
         continue;
-      }
-      else {
-        if (!GEN_isDiscreteEntity(modelFace)) { // parametric
-          vIter = M_classifiedVertexIter(pm, modelFace, 0);
-          while((meshVertex = VIter_next(vIter))){
-            V_coord(meshVertex, xyz);
-            apf::MeshEntity* vtx = reinterpret_cast<apf::MeshEntity*>(meshVertex);
-            apf::getComponents(f, vtx, 0, &vals[0]);
-            const double disp[3] = {vals[0]-xyz[0], vals[1]-xyz[1], vals[2]-xyz[2]};
-            V_movedParamPoint(meshVertex,disp,newpar,newpt);
-            MeshMover_setSurfaceMove(mmover,meshVertex,newpar,newpt);
-          }
-          VIter_delete(vIter);
-        }
-      }
-    }
-    GFIter_delete(gfIter);
-
-    // loop over model edges
-    GEIter geIter = GM_edgeIter(model);
-    while((modelEdge=GEIter_next(geIter))){
-      int id = isOnRigidBody(model, modelEdge, rbms);
-      if(id >= 0) {
-        assert(!GEN_isDiscreteEntity(modelEdge)); // should be parametric geometry
+      if (isOnRigidBody(modelEnt) >= 0)
         continue;
+      int modelType = GEN_type(modelEnt);
+      if (modelType == Gregion) {
+        MeshMover_setVolumeMove(mmover,meshVertex,newloc);
       }
-      else {
-        if (!GEN_isDiscreteEntity(modelEdge)) { // parametric
-          vIter = M_classifiedVertexIter(pm, modelEdge, 0);
-          while((meshVertex = VIter_next(vIter))){
-            V_coord(meshVertex, xyz);
-            apf::MeshEntity* vtx = reinterpret_cast<apf::MeshEntity*>(meshVertex);
-            apf::getComponents(f, vtx, 0, &vals[0]);
-            const double disp[3] = {vals[0]-xyz[0], vals[1]-xyz[1], vals[2]-xyz[2]};
-            V_movedParamPoint(meshVertex,disp,newpar,newpt);
-            MeshMover_setSurfaceMove(mmover,meshVertex,newpar,newpt);
-          }
-          VIter_delete(vIter);
-        }
-      }
-    }
-    GEIter_delete(geIter);
-
-    // loop over model vertices
-    GVIter gvIter = GM_vertexIter(model);
-    while((modelVertex=GVIter_next(gvIter))){
-      int id = isOnRigidBody(model, modelVertex, rbms);
-      if(id >= 0) {
-        assert(!GEN_isDiscreteEntity(modelVertex)); // should be parametric geometry
-        continue;
+      else if (modelType == Gface || modelType == Gedge) {
+        V_coord(meshVertex, xyz);
+        const double disp[3] = {vals[0]-xyz[0], vals[1]-xyz[1], vals[2]-xyz[2]};
+        V_movedParamPoint(meshVertex,disp,newpar,newpt);
+        MeshMover_setSurfaceMove(mmover,meshVertex,newpar,newpt);
       }
-      else {
-        if (!GEN_isDiscreteEntity(modelVertex)) { // parametric
-          vIter = M_classifiedVertexIter(pm, modelVertex, 0);
-          while((meshVertex = VIter_next(vIter))){
-            V_coord(meshVertex, xyz);
-            apf::MeshEntity* vtx = reinterpret_cast<apf::MeshEntity*>(meshVertex);
-            apf::getComponents(f, vtx, 0, &vals[0]);
-            const double disp[3] = {vals[0]-xyz[0], vals[1]-xyz[1], vals[2]-xyz[2]};
-            assert(sqrt(disp[0]*disp[0] + disp[1]*disp[1] + disp[2]*disp[2]) < 1e-10); // threshold 1e-10
-          }
-          VIter_delete(vIter);
-        }
+      else { // model vertices stay put
+        V_coord(meshVertex, xyz);
+        const double disp[3] = {vals[0]-xyz[0], vals[1]-xyz[1], vals[2]-xyz[2]};
+        assert(sqrt(disp[0]*disp[0] + disp[1]*disp[1] + disp[2]*disp[2]) < 1e-10); // threshold 1e-10
       }
     }
-    GVIter_delete(gvIter);
+    VIter_delete(vIter);
 
     // add mesh improver and solution transfer
     pPList sim_fld_lst = PList_new();
     PList_clear(sim_fld_lst);
-    if (cooperation) {
+    if (cooperation == MOVE_ADAPT) {
       addAdapterInMover(mmover, sim_fld_lst, in, m);
       addImproverInMover(mmover, sim_fld_lst);
     }
+    else if (cooperation == MOVE_IMPROVE) {
+      if (in.solutionMigration) {
+        PList_delete(sim_fld_lst);
+        sim_fld_lst = getSimFieldList(in, m, keep);
+      }
+      addImproverInMover(mmover, sim_fld_lst);
+    }
 
     // do real work
     if(!PCU_Comm_Self())
       printf("do real mesh mover\n");
     int isRunMover = MeshMover_run(mmover, progress);
-    assert(isRunMover);
     MeshMover_delete(mmover);
 
     PList_clear(sim_fld_lst);
     PList_delete(sim_fld_lst);
 
+    if (!isRunMover) {
+      if(!PCU_Comm_Self())
+        fprintf(stderr, "mesh mover failed\n");
+      Progress_delete(progress);
+      return false;
+    }
+
     if (cooperation) {
       // load balance
-      balanceEqualWeights(ppm, progress);
+      if (cooperation == MOVE_ADAPT)
+        balanceMesh(m, progress);
 
       // transfer sim fields to apf fields
       if (in.solutionMigration)
@@ -643,14 +601,21 @@ if (pm) {
 
 
 
-  void runMeshMover(ph::Input& in, apf::Mesh2* m, int step, int cooperation) {
+  bool moveMesh(ph::Input& in, apf::Mesh2* m, int step, int cooperation,
+                apf::Field* keep) {
     bool done = false;
     if (in.simmetrixMesh) {
-      done = updateSIMCoordAuto(in, m, cooperation);
+      done = updateSIMCoordAuto(in, m, cooperation, keep);
     }
     else {
       done = updateAPFCoord(in, m);
     }
+    return done;
+  }
+
+  void runMeshMover(ph::Input& in, apf::Mesh2* m, int step, int cooperation,
+                    apf::Field* keep) {
+    bool done = moveMesh(in, m, step, cooperation, keep);
     assert(done);
   }
 
@@ -667,4 +632,120 @@ if (pm) {
     }
   }
 
+  /* mesh the current model from scratch with the average edge length of
+     the old mesh, project the fields onto it and replace m */
+  void remeshAndProject(ph::Input& in, apf::Mesh2*& m) {
+    pProgress progress = Progress_new();
+    Progress_setDefaultCallback(progress);
+
+    apf::MeshSIM* apf_msim = dynamic_cast<apf::MeshSIM*>(m);
+    pGModel model = gmi_export_sim(apf_msim->getModel());
+
+    // target size
+    double edgeLen = 0.0;
+    long numEdges = m->count(1);
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(1);
+    while ((e = m->iterate(it)))
+      edgeLen += apf::measure(m, e);
+    m->end(it);
+    double h = PCU_Add_Double(edgeLen) / PCU_Add_Long(numEdges);
+    if(!PCU_Comm_Self())
+      printf("remesh the model with mesh size %f\n", h);
+
+    // surface and volume meshing into a new partitioned mesh
+    pParMesh ppm = PM_new(0, model, PMU_size());
+    pACase mcase = MS_newMeshCase(model);
+    MS_setMeshSize(mcase, GM_domain(model), 1, h, NULL);
+    pSurfaceMesher surfMesher = SurfaceMesher_new(mcase, ppm);
+    SurfaceMesher_execute(surfMesher, progress);
+    SurfaceMesher_delete(surfMesher);
+    pVolumeMesher volMesher = VolumeMesher_new(mcase, ppm);
+    VolumeMesher_execute(volMesher, progress);
+    VolumeMesher_delete(volMesher);
+    MS_deleteMeshCase(mcase);
+    balanceEqualWeights(ppm, progress);
+
+    // fields may still be split into sim fields by a failed adapt
+    if (m->findField("pressure"))
+      transferSimFields(m);
+    apf::Mesh2* new_m = apf::createMesh(ppm);
+    ProjectionOperator* op = 0;
+    projectFields(m, new_m, 0, op);
+    destroyProjectionOperator(op);
+
+    writeSIMMesh(ppm, in.timeStepNumber, "sim_remeshed_mesh_");
+    m->destroyNative();
+    apf::destroyMesh(m);
+    m = new_m;
+    Progress_delete(progress);
+  }
+
+  /* move only, and adapt when the moved mesh crosses the limits */
+  void updateMeshOnDemand(ph::Input& in, apf::Mesh2*& m, apf::Field* szFld,
+                          int step, QualityLimits const& limits,
+                          QualityMonitor* qm) {
+    int cooperation = MOVE_ONLY;
+    if (in.simmetrixMesh && limits.improve)
+      cooperation = MOVE_IMPROVE;
+    // the size deviation check still needs szFld after the improver
+    pc::runMeshMover(in,m,step,cooperation,szFld);
+    m->verify();
+    if (!needsAdapt(m, szFld, updateQualityMonitor(qm, m), limits))
+      return;
+    pc::runMeshAdapter(in,m,szFld,step);
+    m->verify();
+  }
+
+  /* remeshing meshes the model with one uniform size, which would drop
+     the boundary layers */
+  static bool hasBoundaryLayers(apf::Mesh* m) {
+    int found = 0;
+    apf::MeshEntity* e;
+    apf::MeshIterator* it = m->begin(3);
+    while ((e = m->iterate(it)))
+      if (EN_isBLEntity(reinterpret_cast<pEntity>(e))) {
+        found = 1;
+        break;
+      }
+    m->end(it);
+    return PCU_Max_Int(found);
+  }
+
+  void updateMeshOrRemesh(ph::Input& in, apf::Mesh2*& m, apf::Field* szFld,
+                          int step, int cooperation, QualityLimits const& limits,
+                          QualityMonitor* qm) {
+    bool canRemesh = in.simmetrixMesh && limits.remeshQuality > 0.0;
+    if (canRemesh && hasBoundaryLayers(m)) {
+      if(!PCU_Comm_Self())
+        printf("boundary layer mesh, remeshing disabled\n");
+      canRemesh = false;
+    }
+    if (!canRemesh) {
+      if (limits.adaptOnDemand)
+        updateMeshOnDemand(in, m, szFld, step, limits, qm);
+      else
+        updateMesh(in, m, szFld, step, cooperation);
+      updateQualityMonitor(qm, m);
+      return;
+    }
+    // move alone first, so a badly moved mesh is remeshed instead of
+    // going through the improver and adapter
+    bool moved = moveMesh(in, m, step, MOVE_ONLY, 0);
+    if (moved)
+      m->verify();
+    QualityStats stats = updateQualityMonitor(qm, m);
+    if (!moved || stats.minQuality < limits.remeshQuality) {
+      releaseQualityMonitor(qm);
+      remeshAndProject(in, m);
+      m->verify();
+      updateQualityMonitor(qm, m);
+      return;
+    }
+    if (limits.adaptOnDemand && !needsAdapt(m, szFld, stats, limits))
+      return;
+    pc::runMeshAdapter(in,m,szFld,step);
+    m->verify();
+    updateQualityMonitor(qm, m);
+  }
 }
@@ -6,7 +6,9 @@
 #include <apfSIM.h>
 #include <apfMDS.h>
 #include <chef.h>
+#include "pcQuality.h"
 #include <list>
+#include <vector>
 #include <cstring>
 #include <cstdlib>
 
@@ -49,18 +51,77 @@ namespace pc {
     std::list<int> parSurEdges;
   };
 
-  meshMotion getTDMeshMotion(int caseId, int step);
+  /* prescribed rigid body motion of model region tags, read once from a
+     schedule file and tabulated for steps 0 to numSteps */
+  struct MotionSchedule {
+    struct Body {
+      int tag;
+      std::vector<double> trans; // 3 per step, summed over earlier steps
+      std::vector<double> angle; // summed over earlier steps
+      std::vector<double> point; // 3 per step, rotation point at the step
+      std::vector<double> axis;  // 3 per step
+      std::vector<double> scale;
+    };
+    std::vector<Body> bodies;
+    int numSteps;
+    int lastStep; // step the mesh was last moved to
+  };
+
+  /* 0 if the file cannot be read; the mover starts from firstStep */
+  MotionSchedule* loadMotionSchedule(const char* filename, int numSteps, int firstStep);
+
+  void destroyMotionSchedule(MotionSchedule* ms);
+
+  /* motion of every body from step to step + stride, one transform each */
+  meshMotion getScheduledMotion(MotionSchedule const& ms, int step, int stride);
+
+  /* while set, the Simmetrix mover takes its rigid body motions from ms
+     instead of the solver, covering the steps since the last move */
+  void setMotionSchedule(MotionSchedule* ms);
+
+  /* what the Simmetrix mesh mover runs with; simCooperation
+     switches between the first two */
+  enum MoverCooperation {
+    MOVE_ONLY = 0,
+    MOVE_ADAPT = 1,
+    MOVE_IMPROVE = 2
+  };
 
   bool updateAPFCoord(ph::Input& in, apf::Mesh2* m);
 
-  bool updateAndWriteSIMDiscreteCoord(apf::Mesh2* m);
+  /* dump the vertex displacements with writeDisplacements; the serial
+     mesh and discrete model are only built and written on request */
+  bool updateAndWriteSIMDiscreteCoord(apf::Mesh2* m, bool writeSerial = false);
 
   bool updateAndWriteSIMDiscreteField(apf::Mesh2* m);
 
-  void runMeshMover(ph::Input& in, apf::Mesh2* m, int step, int cooperation = 0);
+  /* move m, false if the Simmetrix mover fails */
+  bool moveMesh(ph::Input& in, apf::Mesh2* m, int step, int cooperation = 0,
+                apf::Field* keep = 0);
+
+  /* moveMesh that must succeed; keep: a field the improver must not
+     strip from m */
+  void runMeshMover(ph::Input& in, apf::Mesh2* m, int step, int cooperation = 0,
+                    apf::Field* keep = 0);
 
   void updateMesh(ph::Input& in, apf::Mesh2* m, apf::Field* szFld, int step, int cooperation = 1);
 
+  void remeshAndProject(ph::Input& in, apf::Mesh2*& m);
+
+  void updateMeshOnDemand(ph::Input& in, apf::Mesh2*& m, apf::Field* szFld,
+                          int step, QualityLimits const& limits,
+                          QualityMonitor* qm);
+
+  /* updateMesh, or updateMeshOnDemand when limits ask for it. with
+     limits.remeshQuality set on a Simmetrix mesh without boundary layers,
+     the mesh is moved alone first; if the mover fails or the smallest
+     tet mean ratio reported by qm drops below limits.remeshQuality, the
+     model is remeshed and the fields projected in place of the improve
+     and adapt step */
+  void updateMeshOrRemesh(ph::Input& in, apf::Mesh2*& m, apf::Field* szFld,
+                          int step, int cooperation, QualityLimits const& limits,
+                          QualityMonitor* qm);
+
   void balanceEqualWeights(pParMesh pmesh, pProgress progress);
 
 // hardcoding {
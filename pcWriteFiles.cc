@@ -2,11 +2,13 @@
 #include "SimModel.h"
 #include "apfSIM.h"
 #include "apfMDS.h"
+#include <apfNumbering.h>
 #include <PCU.h>
 #include <sstream>
 #include <cstdio>
 #include <cassert>
 #include <algorithm>
+#include <vector>
 #include <math.h>
 #include <SimPartitionedMesh.h>
 #include "SimModel.h"
@@ -159,4 +161,139 @@ namespace pc {
     fclose (sFile);
   }
 
+  /* displacement dump layout: a header of eight 8-byte words (magic,
+     version, number of parts, total vertices, rest zero), one vertex
+     count per part, then the part blocks in rank order. A block holds
+     one record per owned vertex: global id, then dx dy dz. */
+  static const long dispMagic = 0x5043444953500000L; // "PCDISP"
+  static const long dispVersion = 1;
+  static const int dispHeaderWords = 8;
+
+  struct DispRecord {
+    long gid;
+    double disp[3];
+  };
+
+  static void collectDispRecords(apf::Mesh* m, apf::Field* motion,
+                                 std::vector<DispRecord>& records,
+                                 std::vector<apf::MeshEntity*>* verts) {
+    apf::Numbering* local = apf::numberOwnedDimension(m, "disp_gid", 0);
+    apf::GlobalNumbering* gids = apf::makeGlobal(local);
+    apf::Vector3 x;
+    double vals[3];
+    apf::MeshEntity* v;
+    apf::MeshIterator* it = m->begin(0);
+    while ((v = m->iterate(it))) {
+      if (!m->isOwned(v))
+        continue;
+      DispRecord r;
+      r.gid = apf::getNumber(gids, apf::Node(v, 0));
+      if (motion) {
+        m->getPoint(v, 0, x);
+        apf::getComponents(motion, v, 0, vals);
+        for (int i = 0; i < 3; i++)
+          r.disp[i] = vals[i] - x[i];
+      }
+      records.push_back(r);
+      if (verts)
+        verts->push_back(v);
+    }
+    m->end(it);
+    apf::destroyGlobalNumbering(gids);
+  }
+
+  bool writeDisplacements(apf::Mesh* m, apf::Field* motion, const char* filename) {
+    assert(apf::countComponents(motion) == 3);
+    std::vector<DispRecord> records;
+    collectDispRecords(m, motion, records, 0);
+
+    long count = records.size();
+    long before = 0;
+    MPI_Exscan(&count, &before, 1, MPI_LONG, MPI_SUM, PCU_Get_Comm());
+    if (!PCU_Comm_Self())
+      before = 0;
+    long total = PCU_Add_Long(count);
+    int peers = PCU_Comm_Peers();
+    int self = PCU_Comm_Self();
+
+    MPI_File fh;
+    if (MPI_File_open(PCU_Get_Comm(), const_cast<char*>(filename),
+                      MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+      if (!self)
+        fprintf(stderr, "cannot open displacement file %s\n", filename);
+      return false;
+    }
+    MPI_File_set_size(fh, 0);
+    MPI_Offset tableStart = dispHeaderWords * sizeof(long);
+    MPI_Offset dataStart = tableStart + (MPI_Offset)peers * sizeof(long);
+    if (!self) {
+      long header[dispHeaderWords] = {dispMagic, dispVersion, peers, total, 0, 0, 0, 0};
+      MPI_File_write_at(fh, 0, header, dispHeaderWords, MPI_LONG, MPI_STATUS_IGNORE);
+    }
+    MPI_File_write_at_all(fh, tableStart + (MPI_Offset)self * sizeof(long),
+                          &count, 1, MPI_LONG, MPI_STATUS_IGNORE);
+    MPI_File_write_at_all(fh, dataStart + (MPI_Offset)before * sizeof(DispRecord),
+                          records.empty() ? 0 : &records[0],
+                          (int)(count * sizeof(DispRecord)), MPI_BYTE,
+                          MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    if (!self)
+      printf("wrote %ld vertex displacements to %s\n", total, filename);
+    return true;
+  }
+
+  bool readDisplacements(apf::Mesh* m, apf::Field* disp, const char* filename) {
+    assert(apf::countComponents(disp) == 3);
+    MPI_File fh;
+    if (MPI_File_open(PCU_Get_Comm(), const_cast<char*>(filename),
+                      MPI_MODE_RDONLY, MPI_INFO_NULL, &fh) != MPI_SUCCESS) {
+      if (!PCU_Comm_Self())
+        fprintf(stderr, "cannot open displacement file %s\n", filename);
+      return false;
+    }
+    int peers = PCU_Comm_Peers();
+    int self = PCU_Comm_Self();
+    long header[dispHeaderWords];
+    MPI_File_read_at_all(fh, 0, header, dispHeaderWords, MPI_LONG, MPI_STATUS_IGNORE);
+    if (header[0] != dispMagic || header[1] != dispVersion || header[2] != peers) {
+      if (!self)
+        fprintf(stderr, "%s is not a displacement file for %d parts\n", filename, peers);
+      MPI_File_close(&fh);
+      return false;
+    }
+    MPI_Offset tableStart = dispHeaderWords * sizeof(long);
+    MPI_Offset dataStart = tableStart + (MPI_Offset)peers * sizeof(long);
+    long count;
+    MPI_File_read_at_all(fh, tableStart + (MPI_Offset)self * sizeof(long),
+                         &count, 1, MPI_LONG, MPI_STATUS_IGNORE);
+    long before = 0;
+    MPI_Exscan(&count, &before, 1, MPI_LONG, MPI_SUM, PCU_Get_Comm());
+    if (!self)
+      before = 0;
+
+    // the blocks are only valid for the partition they were written from
+    std::vector<DispRecord> mine;
+    std::vector<apf::MeshEntity*> verts;
+    collectDispRecords(m, 0, mine, &verts);
+    int ok = (count == (long)mine.size());
+    std::vector<DispRecord> records(ok ? count : 0);
+    MPI_File_read_at_all(fh, dataStart + (MPI_Offset)before * sizeof(DispRecord),
+                         records.empty() ? 0 : &records[0],
+                         (int)(records.size() * sizeof(DispRecord)), MPI_BYTE,
+                         MPI_STATUS_IGNORE);
+    MPI_File_close(&fh);
+    for (size_t i = 0; ok && i < records.size(); i++)
+      if (records[i].gid != mine[i].gid)
+        ok = 0;
+    if (PCU_Min_Int(ok) == 0) {
+      if (!self)
+        fprintf(stderr, "%s does not match the mesh partition\n", filename);
+      return false;
+    }
+    for (size_t i = 0; i < records.size(); i++)
+      apf::setComponents(disp, verts[i], 0, records[i].disp);
+    apf::synchronize(disp);
+    return true;
+  }
+
 }
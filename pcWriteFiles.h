@@ -16,6 +16,16 @@ namespace pc {
   void writeSIMMesh (pParMesh mesh, int step, const char* filename);
 
   void writePHTfiles (int old_step, int cur_step, phSolver::Input& inp);
+
+  /* write the displacement of each owned vertex from its motion
+     coordinates to one binary file with MPI-IO: a header, a vertex count
+     per part, then per part blocks of (global id, dx, dy, dz); false when
+     the file cannot be opened */
+  bool writeDisplacements (apf::Mesh* m, apf::Field* motion, const char* filename);
+
+  /* read such a file back into a vector field on the same partition of
+     the same mesh; false when the file does not match */
+  bool readDisplacements (apf::Mesh* m, apf::Field* disp, const char* filename);
 }
 
 #endif
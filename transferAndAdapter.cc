@@ -179,9 +179,11 @@ int main(int argc, char** argv) {
   PCU_Comm_Init();
   PCU_Protect();
   lion_set_verbosity(1);
-  if( argc != 2 ) {
+  bool writeSerial = (argc == 3 && !strcmp(argv[2], "-serial"));
+  if( argc != 2 && !writeSerial ) {
     if(!PCU_Comm_Self())
-      fprintf(stderr, "Usage: %s <mode id>\n",argv[0]);
+      fprintf(stderr, "Usage: %s <mode id> [-serial]\n"
+                      "  -serial  mode 1 also writes the serial mesh and discrete model\n",argv[0]);
     exit(EXIT_FAILURE);
   }
   int modeId  = atoi(argv[1]);
@@ -219,7 +221,7 @@ int main(int argc, char** argv) {
     chef::preprocess(m,ctrl,grs);
   }
   else if(modeId == 1) {
-    pc::updateAndWriteSIMDiscreteCoord(m);
+    pc::updateAndWriteSIMDiscreteCoord(m, writeSerial);
   }
   else if(modeId == 2) {
     pc::updateAndWriteSIMDiscreteField(m);